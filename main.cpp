@@ -1,164 +1,5722 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
-#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <cstring>
 #include <algorithm>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <new>
+#include <optional>
+#include <regex>
 #include <termios.h>
 #include <unistd.h>
 #include <csignal>
+#include <cerrno>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netdb.h>
+#include <sys/sysinfo.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include <linux/io_uring.h>
+#include <linux/bpf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
 
 
-struct ProcessInfo {
+// Self-profiling, always on. Each thread that samples, serves or renders
+// attaches a ThreadProfile and is its only writer, so counting is a load and
+// a store to memory no other thread writes, with no atomic read-modify-write.
+// The fields are relaxed atomics only so the ? overlay can read them while
+// they move. ProfileScope times the pipeline stages into the same profile,
+// and with --trace also into a per-thread ring of events for the Chrome
+// trace written at exit.
+enum class Stage : uint8_t { Scan, Filter, Sort, Render, Export, Count };
+
+const char *stageName(Stage stage) {
+    static const char *const names[] = {"scan", "filter", "sort", "render", "export"};
+    return names[(int)stage];
+}
+
+uint64_t profileNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// What a thread did, summed since it attached (or, for Profiler::lastScan,
+// during the last scan across all threads).
+struct ProfileCounters {
+    uint64_t syscalls = 0, bytesRead = 0, parseNs = 0, procsScanned = 0, allocations = 0;
+};
+
+struct TraceEvent {
+    Stage stage;
+    uint64_t startNs, durationNs;
+    ProfileCounters scan;  // for Scan events: what the whole pass did
+};
+
+struct ThreadProfile {
+    using Counter = std::atomic<uint64_t>;
+    static constexpr size_t kTraceEvents = 1 << 15;  // the newest ones are kept
+
+    char name[16] = {};
+    int tid = 0;
+    std::atomic<bool> retired{false};  // its thread exited; a new thread of the same name takes it over
+    Counter syscalls{0}, bytesRead{0}, parseNs{0}, procsScanned{0}, allocations{0};
+    Counter stageNs[(int)Stage::Count] = {}, stageCalls[(int)Stage::Count] = {}, stageLastNs[(int)Stage::Count] = {};
+    std::unique_ptr<TraceEvent[]> trace;  // only with --trace
+    Counter traceCount{0};
+    unsigned parseTick = 0;
+
+    static void add(Counter &counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    ProfileCounters counters() const {
+        ProfileCounters out;
+        out.syscalls = syscalls.load(std::memory_order_relaxed);
+        out.bytesRead = bytesRead.load(std::memory_order_relaxed);
+        out.parseNs = parseNs.load(std::memory_order_relaxed);
+        out.procsScanned = procsScanned.load(std::memory_order_relaxed);
+        out.allocations = allocations.load(std::memory_order_relaxed);
+        return out;
+    }
+};
+
+// The calling thread's profile; null until it attaches, and for threads
+// that never do. Trivially constructed, so reading it costs one TLS load.
+thread_local ThreadProfile *currentProfile = nullptr;
+
+// Every profile ever attached, in attach order. Profiles are never freed:
+// the overlay and the trace read them without locks, and a retired one
+// is handed to the next thread that attaches under its name, so restarting
+// worker pools (as --bench does) doesn't grow the list.
+class Profiler {
+public:
+    static constexpr size_t kMaxThreads = 256;
+
+    std::atomic<bool> tracing{false};  // set before any thread attaches
+    // What the last finished scan cost, summed over every thread
+    std::atomic<uint64_t> lastScan[5] = {};
+
+    // Attaches the calling thread under name (at most 15 characters kept).
+    void attach(const char *name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = count.load(std::memory_order_relaxed);
+        ThreadProfile *profile = nullptr;
+        for (size_t i = 0; i < n && !profile; ++i)
+            if (threads[i]->retired.load(std::memory_order_relaxed) && strncmp(threads[i]->name, name, 15) == 0)
+                profile = threads[i];
+        if (!profile) {
+            if (n == kMaxThreads) return;  // unprofiled rather than unbounded
+            profile = new ThreadProfile;
+            strncpy(profile->name, name, sizeof(profile->name) - 1);
+            profile->tid = (int)syscall(SYS_gettid);
+            if (tracing.load(std::memory_order_relaxed)) profile->trace.reset(new TraceEvent[ThreadProfile::kTraceEvents]);
+            threads[n] = profile;
+            count.store(n + 1, std::memory_order_release);
+        }
+        profile->retired.store(false, std::memory_order_relaxed);
+        currentProfile = profile;
+        attachment.profile = profile;
+    }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    const ThreadProfile &at(size_t i) const { return *threads[i]; }
+
+    ProfileCounters totals() const {
+        ProfileCounters sum;
+        for (size_t i = 0, n = size(); i < n; ++i) {
+            ProfileCounters c = threads[i]->counters();
+            sum.syscalls += c.syscalls;
+            sum.bytesRead += c.bytesRead;
+            sum.parseNs += c.parseNs;
+            sum.procsScanned += c.procsScanned;
+            sum.allocations += c.allocations;
+        }
+        return sum;
+    }
+
+private:
+    // Retires the thread's profile when the thread exits
+    struct Attachment {
+        ThreadProfile *profile = nullptr;
+        ~Attachment() {
+            if (profile) profile->retired.store(true, std::memory_order_relaxed);
+        }
+    };
+    static thread_local Attachment attachment;
+
+    ThreadProfile *threads[kMaxThreads] = {};
+    std::atomic<size_t> count{0};
+    std::mutex mutex;
+};
+
+thread_local Profiler::Attachment Profiler::attachment;
+Profiler profiler;
+
+// Counts syscalls the calling thread issued, and the bytes they read.
+inline void countSyscalls(unsigned calls, ssize_t bytesRead = 0) {
+    if (ThreadProfile *profile = currentProfile) {
+        ThreadProfile::add(profile->syscalls, calls);
+        if (bytesRead > 0) ThreadProfile::add(profile->bytesRead, bytesRead);
+    }
+}
+
+inline void countProcsScanned(unsigned n = 1) {
+    if (ThreadProfile *profile = currentProfile) ThreadProfile::add(profile->procsScanned, n);
+}
+
+// Times one stage of the pipeline on the calling thread. A Scan scope also
+// records what the whole pass cost in Profiler::lastScan.
+class ProfileScope {
+public:
+    explicit ProfileScope(Stage stage) : stage(stage), profile(currentProfile) {
+        if (!profile) return;
+        if (stage == Stage::Scan) before = profiler.totals();
+        start = profileNowNs();
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    ~ProfileScope() {
+        if (!profile) return;
+        uint64_t duration = profileNowNs() - start;
+        int i = (int)stage;
+        ThreadProfile::add(profile->stageNs[i], duration);
+        ThreadProfile::add(profile->stageCalls[i], 1);
+        profile->stageLastNs[i].store(duration, std::memory_order_relaxed);
+
+        ProfileCounters scan;
+        if (stage == Stage::Scan) {
+            ProfileCounters after = profiler.totals();
+            scan = {after.syscalls - before.syscalls, after.bytesRead - before.bytesRead, after.parseNs - before.parseNs,
+                    after.procsScanned - before.procsScanned, after.allocations - before.allocations};
+            uint64_t values[5] = {scan.syscalls, scan.bytesRead, scan.parseNs, scan.procsScanned, scan.allocations};
+            for (int v = 0; v < 5; ++v) profiler.lastScan[v].store(values[v], std::memory_order_relaxed);
+        }
+        if (profile->trace) {
+            uint64_t n = profile->traceCount.load(std::memory_order_relaxed);
+            profile->trace[n % ThreadProfile::kTraceEvents] = {stage, start, duration, scan};
+            profile->traceCount.store(n + 1, std::memory_order_release);
+        }
+    }
+
+private:
+    Stage stage;
+    ThreadProfile *profile;
+    uint64_t start = 0;
+    ProfileCounters before;
+};
+
+// Times the parse it scopes once every kEvery calls and credits the thread
+// with kEvery times the measurement, which keeps the clock reads off all but
+// a sliver of the per-process hot path.
+class ParseTimer {
+public:
+    ParseTimer() {
+        ThreadProfile *candidate = currentProfile;
+        if (candidate && ++candidate->parseTick % kEvery == 0) {
+            profile = candidate;
+            start = profileNowNs();
+        }
+    }
+    ~ParseTimer() {
+        if (profile) ThreadProfile::add(profile->parseNs, (profileNowNs() - start) * kEvery);
+    }
+
+private:
+    static constexpr unsigned kEvery = 16;
+    ThreadProfile *profile = nullptr;
+    uint64_t start = 0;
+};
+
+// Counts every call to the global operator new so the footer and --bench can
+// show how many heap allocations a tick makes, and the profile which thread
+// made them. Kept out of line so GCC doesn't pair the malloc/free inside
+// with new/delete at inlined call sites.
+std::atomic<unsigned long long> heapAllocations{0};
+
+__attribute__((noinline)) void *operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (ThreadProfile *profile = currentProfile) ThreadProfile::add(profile->allocations, 1);
+    if (void *ptr = malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept { free(ptr); }
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+// Bump allocator for per-tick scratch. reset() rewinds to the first chunk
+// without freeing anything, so once the chunks have grown to a tick's
+// high-water mark, later ticks don't touch the heap at all.
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(size_t chunkSize = 64 << 10) : chunkSize(chunkSize) {}
+
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+        while (true) {
+            if (current == chunks.size()) {
+                size_t size = std::max(chunkSize, bytes + align);
+                chunks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+            }
+            Chunk &chunk = chunks[current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data.get());
+            uintptr_t start = (base + offset + align - 1) & ~(uintptr_t)(align - 1);
+            if (start + bytes <= base + chunk.size) {
+                offset = start + bytes - base;
+                return reinterpret_cast<void *>(start);
+            }
+            ++current;
+            offset = 0;
+        }
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0, offset = 0;
+    size_t chunkSize;
+};
+
+// Interned command names. A name's string is created once, the first time
+// a process carrying it is seen, and ids and string addresses stay valid for
+// the life of the pool. Interning takes a lock, but only new or renamed
+// processes intern, so the steady-state sampling path never does. Lookups
+// take no lock: strings live in fixed-size chunks that never move, so a
+// reader on another thread can resolve any id it was handed, even while
+// the sampler interns new names.
+class NamePool {
+public:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    NamePool() = default;
+    NamePool(const NamePool &) = delete;
+    NamePool &operator=(const NamePool &) = delete;
+    ~NamePool() {
+        for (std::string *chunk : chunks) delete[] chunk;
+    }
+
+    uint32_t intern(const char *text, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(std::string_view(text, len));
+        if (it != index.end()) return it->second;
+        uint32_t id = (uint32_t)count.load(std::memory_order_relaxed);
+        if (id / kChunkSize >= kMaxChunks) return id ? id - 1 : 0;  // full: alias rather than grow (needs 4M names)
+        std::string *&chunk = chunks[id / kChunkSize];
+        if (!chunk) chunk = new std::string[kChunkSize];
+        chunk[id % kChunkSize].assign(text, len);
+        index.emplace(chunk[id % kChunkSize], id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    const std::string &name(uint32_t id) const { return chunks[id / kChunkSize][id % kChunkSize]; }
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+private:
+    static constexpr size_t kChunkSize = 1024, kMaxChunks = 4096;
+    std::string *chunks[kMaxChunks] = {};
+    std::atomic<size_t> count{0};
+    std::unordered_map<std::string_view, uint32_t> index;
+    std::mutex mutex;
+};
+
+// One tick's process table as parallel columns; row i is pid[i], cpu[i], ...
+// Names are ids into the sampler's NamePool, so a tick copies no strings.
+// The stat fields only some columns show; cheap to parse along with the rest.
+struct StatDetails {
+    uint64_t vszKb = 0;
+    uint32_t threads = 0;
+    char state = '?';  // R, S, D, Z, ...; '?' where the source doesn't carry it
+};
+
+// Bytes per second from deltas of /proc/<pid>/io: what went to and from
+// storage, and rchar/wchar, which count every read()/write() including
+// sockets and pipes.
+struct IoRates {
+    uint64_t readBps = 0, writeBps = 0, rcharBps = 0, wcharBps = 0;
+};
+
+struct ProcessTable {
+    std::vector<int> pid;
+    std::vector<double> cpu;  // % of all CPUs over the last interval
+    std::vector<uint64_t> rssKb;
+    std::vector<uint64_t> swapKb;  // only filled with --status
+    std::vector<unsigned long long> startTime;
+    std::vector<uint32_t> nameId;
+    std::vector<uint64_t> vszKb;
+    std::vector<uint32_t> threads;
+    std::vector<char> state;
+    std::vector<IoRates> io;  // zero unless the pass read io
+    std::vector<uint8_t> changed;  // 0 when the row shows exactly what it did last tick
+    const NamePool *names = nullptr;
+    unsigned long long tick = 0;  // which sampler pass filled the table
+
+    size_t size() const { return pid.size(); }
+    bool empty() const { return pid.empty(); }
+
+    const std::string &name(size_t row) const { return names->name(nameId[row]); }
+
+    void clear() {
+        pid.clear();
+        cpu.clear();
+        rssKb.clear();
+        swapKb.clear();
+        startTime.clear();
+        nameId.clear();
+        vszKb.clear();
+        threads.clear();
+        state.clear();
+        io.clear();
+        changed.clear();
+    }
+
+    void reserve(size_t n) {
+        pid.reserve(n);
+        cpu.reserve(n);
+        rssKb.reserve(n);
+        swapKb.reserve(n);
+        startTime.reserve(n);
+        nameId.reserve(n);
+        vszKb.reserve(n);
+        threads.reserve(n);
+        state.reserve(n);
+        io.reserve(n);
+        changed.reserve(n);
+    }
+
+    void push(int rowPid, double rowCpu, uint64_t rowRssKb, uint64_t rowSwapKb, unsigned long long rowStartTime,
+              uint32_t rowNameId, bool rowChanged = true, const StatDetails &rowDetails = StatDetails(),
+              const IoRates &rowIo = IoRates()) {
+        pid.push_back(rowPid);
+        cpu.push_back(rowCpu);
+        rssKb.push_back(rowRssKb);
+        swapKb.push_back(rowSwapKb);
+        startTime.push_back(rowStartTime);
+        nameId.push_back(rowNameId);
+        vszKb.push_back(rowDetails.vszKb);
+        threads.push_back(rowDetails.threads);
+        state.push_back(rowDetails.state);
+        io.push_back(rowIo);
+        changed.push_back(rowChanged);
+    }
+
+    void append(const ProcessTable &other) {
+        pid.insert(pid.end(), other.pid.begin(), other.pid.end());
+        cpu.insert(cpu.end(), other.cpu.begin(), other.cpu.end());
+        rssKb.insert(rssKb.end(), other.rssKb.begin(), other.rssKb.end());
+        swapKb.insert(swapKb.end(), other.swapKb.begin(), other.swapKb.end());
+        startTime.insert(startTime.end(), other.startTime.begin(), other.startTime.end());
+        nameId.insert(nameId.end(), other.nameId.begin(), other.nameId.end());
+        vszKb.insert(vszKb.end(), other.vszKb.begin(), other.vszKb.end());
+        threads.insert(threads.end(), other.threads.begin(), other.threads.end());
+        state.insert(state.end(), other.state.begin(), other.state.end());
+        io.insert(io.end(), other.io.begin(), other.io.end());
+        changed.insert(changed.end(), other.changed.begin(), other.changed.end());
+    }
+
+    // Rows picked by the active filter, one bit per row. Filtering only
+    // clears bits, so the full table stays intact underneath.
+    std::vector<uint64_t> selection;
+    size_t selectedCount = 0;
+
+    bool selected(size_t row) const { return selection[row >> 6] >> (row & 63) & 1; }
+
+    void select(size_t row) {
+        selection[row >> 6] |= 1ULL << (row & 63);
+        ++selectedCount;
+    }
+
+    void selectAll() {
+        selection.assign((size() + 63) / 64, ~0ULL);
+        if (size() % 64) selection.back() = (1ULL << (size() % 64)) - 1;
+        selectedCount = size();
+    }
+};
+
+// A process is identified by pid plus start time so a recycled pid never
+// inherits the previous owner's counters.
+struct ProcessKey {
+    int pid;
+    unsigned long long startTime;
+
+    bool operator==(const ProcessKey &other) const {
+        return pid == other.pid && startTime == other.startTime;
+    }
+};
+
+struct ProcessKeyHash {
+    size_t operator()(const ProcessKey &key) const {
+        return std::hash<unsigned long long>()(key.startTime * 0x9e3779b97f4a7c15ULL ^ (unsigned)key.pid);
+    }
+};
+
+// Previous tick's counters, used to turn cumulative jiffies into interval CPU%.
+struct CpuHistory {
+    struct Sample {
+        unsigned long long ticks = 0;  // utime + stime
+        unsigned long generation = 0;
+        uint32_t nameId = NamePool::kNone;
+        const std::string *name = nullptr;  // the pool's string for nameId
+        // The row pushed last tick, reused while the stat file is unchanged
+        uint64_t rssKb = 0, swapKb = 0;
+        StatDetails details;
+        // rchar, wchar, read_bytes, write_bytes at the last io read, and when
+        // (steady clock seconds; 0 before the first)
+        uint64_t ioCounters[4] = {};
+        double ioTime = 0;
+        bool idle = false;  // last tick's row showed 0% CPU
+    };
+
+    std::pmr::unordered_map<ProcessKey, Sample, ProcessKeyHash> samples;
+    unsigned long generation = 0;
+
+    explicit CpuHistory(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : samples(resource) {}
+
+    // Records this tick's ticks for a process and sets used to the jiffies it
+    // used since the last tick, or 0 the first time it is seen.
+    Sample &update(const ProcessKey &key, unsigned long long ticks, unsigned long long &used) {
+        auto it = samples.find(key);
+        if (it == samples.end()) {
+            used = 0;
+            Sample &sample = samples[key];
+            sample.ticks = ticks;
+            sample.generation = generation;
+            return sample;
+        }
+        used = ticks >= it->second.ticks ? ticks - it->second.ticks : 0;
+        it->second.ticks = ticks;
+        it->second.generation = generation;
+        return it->second;
+    }
+
+    // Marks a known process as seen this tick without new counters, or
+    // returns nullptr if it isn't known.
+    Sample *touch(const ProcessKey &key) {
+        auto it = samples.find(key);
+        if (it == samples.end()) return nullptr;
+        it->second.generation = generation;
+        return &it->second;
+    }
+
+    // Drops every process that wasn't seen during the current tick.
+    void evictDead() {
+        for (auto it = samples.begin(); it != samples.end();) {
+            if (it->second.generation != generation) it = samples.erase(it);
+            else ++it;
+        }
+    }
+};
+
+// Returns the pid named by a /proc entry, or 0 if the entry isn't all digits.
+int parsePid(const char *name) {
+    int pid = 0;
+    for (const char *p = name; *p; ++p) {
+        if (*p < '0' || *p > '9') return 0;
+        pid = pid * 10 + (*p - '0');
+    }
+    return pid;
+}
+
+// Where procfs is read from. Only the benchmark points this elsewhere, at a
+// synthetic tree laid out like /proc.
+const char *procRoot = "/proc";
+
+// Reads a whole /proc file into buf, NUL-terminated. Returns the byte count or -1.
+ssize_t readProcFile(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        countSyscalls(1);
+        return -1;
+    }
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    close(fd);
+    countSyscalls(3, len);
+    if (len < 0) return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+// Minimal io_uring wrapper over the raw syscalls: one submission/completion
+// ring pair, a registered slab of read buffers, and a sparse fixed-file
+// table whose slot numbers are the descriptor numbers themselves.
+class IoRing {
+public:
+    static constexpr unsigned kEntries = 256;
+    static constexpr size_t kSlotSize = 1024;  // one /proc/<pid>/stat read
+
+    IoRing() = default;
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    ~IoRing() {
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    // Sets up the ring; false (with errno set) if io_uring is unavailable.
+    bool init(unsigned fileSlots) {
+        struct io_uring_params params = {};
+        ringFd = (int)syscall(__NR_io_uring_setup, kEntries, &params);
+        if (ringFd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+        if (!sqRing) return false;
+        cqRing = singleMmap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+        if (!cqRing) return false;
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe *>(mapRing(sqesSize, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        buffers.resize(kEntries * kSlotSize);
+        struct iovec iov = {buffers.data(), buffers.size()};
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) != 0) return false;
+
+        // Fixed files are optional: without them reads just pass plain descriptors
+        std::vector<int> empty(fileSlots, -1);
+        if (fileSlots &&
+            syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, empty.data(), fileSlots) == 0) {
+            this->fileSlots = fileSlots;
+        }
+        return true;
+    }
+
+    char *slot(unsigned index) { return buffers.data() + index * kSlotSize; }
+
+    // Mirrors fd into the fixed-file table so reads skip the descriptor lookup.
+    void registerFile(int fd) { updateFile(fd, fd); }
+
+    // Must run before fd is closed: the table holds its own file reference.
+    void unregisterFile(int fd) { updateFile(fd, -1); }
+
+    // Queues a read of fd from offset 0 into buffer slot `index`.
+    void queueRead(int fd, unsigned index) {
+        unsigned tail = *sqTail;
+        unsigned pos = tail & sqMask;
+        struct io_uring_sqe *sqe = &sqes[pos];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = fd;
+        if (fd >= 0 && (unsigned)fd < fileSlots && registered(fd)) sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (uint64_t)(uintptr_t)slot(index);
+        sqe->len = kSlotSize - 1;
+        sqe->off = 0;
+        sqe->buf_index = 0;
+        sqe->user_data = index;
+        sqArray[pos] = pos;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+    }
+
+    // Submits everything queued in one io_uring_enter and waits for it all to
+    // finish, storing each read's result (bytes or -errno) in results[index].
+    bool submitAndWait(int *results) {
+        unsigned toSubmit = queued, toReap = queued;
+        queued = 0;
+        while (toReap) {
+            int n = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, toReap, IORING_ENTER_GETEVENTS, nullptr, 0);
+            countSyscalls(1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            toSubmit -= std::min<unsigned>(toSubmit, n);
+
+            unsigned head = *cqHead;
+            while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const struct io_uring_cqe &cqe = cqes[head & cqMask];
+                results[cqe.user_data] = cqe.res;
+                countSyscalls(0, cqe.res);  // the reads the ring did on our behalf
+                ++head;
+                --toReap;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+private:
+    void *mapRing(size_t size, off_t offset) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    bool registered(int fd) const { return (size_t)fd < registeredFiles.size() && registeredFiles[fd]; }
+
+    void updateFile(int slotIndex, int fd) {
+        if (slotIndex < 0 || (unsigned)slotIndex >= fileSlots) return;
+        struct io_uring_files_update update = {};
+        update.offset = slotIndex;
+        update.fds = (uint64_t)(uintptr_t)&fd;
+        bool ok = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+        if (registeredFiles.size() <= (size_t)slotIndex) registeredFiles.resize(slotIndex + 1);
+        registeredFiles[slotIndex] = ok && fd >= 0;
+    }
+
+    int ringFd = -1;
+    void *sqRing = nullptr, *cqRing = nullptr;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    unsigned *sqTail = nullptr, *sqArray = nullptr, sqMask = 0;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, cqMask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+    std::vector<char> buffers;
+    unsigned fileSlots = 0;
+    std::vector<bool> registeredFiles;
+    unsigned queued = 0;
+};
+
+// /proc/<pid> descriptors kept open across ticks so a steady-state sample is
+// one pread per file. Entries are looked up by pid and remember the start
+// time last read through them; a descriptor of an exited process fails with
+// ESRCH rather than reading a recycled pid, so it's dropped and reopened.
+struct FdCache {
+    struct Entry {
+        int statFd = -1;
+        int statusFd = -1;
+        int ioFd = -1;
+        bool ioDenied = false;  // io needs ptrace access; don't retry every tick
+        unsigned long long startTime = 0;
+        unsigned long generation = 0;
+        std::string lastStat;  // last tick's stat contents, to spot an idle process
+    };
+
+    std::pmr::unordered_map<int, Entry> entries;
+    size_t openFds = 0;
+    size_t maxFds = 0;  // this cache's share of RLIMIT_NOFILE
+    unsigned long generation = 0;
+    IoRing *ring = nullptr;  // set when descriptors are mirrored into a ring's fixed files
+
+    explicit FdCache(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : entries(resource) {}
+    FdCache(const FdCache &) = delete;
+    FdCache &operator=(const FdCache &) = delete;
+    ~FdCache() {
+        for (auto &kv : entries) closeEntry(kv.second);
+    }
+
+    Entry &lookup(int pid) {
+        Entry &entry = entries[pid];
+        entry.generation = generation;
+        return entry;
+    }
+
+    // Reads /proc/<pid>/<file> through fd, opening it if needed and keeping it
+    // open while the budget allows. Returns the byte count or -1.
+    ssize_t read(int &fd, int pid, const char *file, char *buf, size_t size) {
+        if (fd >= 0) {
+            ssize_t len = pread(fd, buf, size - 1, 0);
+            countSyscalls(1, len);
+            if (len >= 0) {
+                buf[len] = '\0';
+                return len;
+            }
+            closeFd(fd);  // ESRCH: the process exited, the pid may be reused
+        }
+
+        if (!openCached(fd, pid, file)) {
+            char path[128];
+            snprintf(path, sizeof(path), "%s/%d/%s", procRoot, pid, file);
+            return readProcFile(path, buf, size);
+        }
+        ssize_t len = pread(fd, buf, size - 1, 0);
+        countSyscalls(1, len);
+        if (len < 0) {
+            closeFd(fd);
+            return -1;
+        }
+        buf[len] = '\0';
+        return len;
+    }
+
+    // Opens /proc/<pid>/<file> into fd and keeps it, unless the budget is
+    // spent. Returns whether fd now holds a cached descriptor.
+    bool openCached(int &fd, int pid, const char *file) {
+        if (fd >= 0) return true;
+        if (openFds >= maxFds) return false;
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%d/%s", procRoot, pid, file);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        countSyscalls(1);
+        if (fd < 0) return false;
+        ++openFds;
+        if (ring) ring->registerFile(fd);
+        return true;
+    }
+
+    // Closes the descriptors of every pid that wasn't looked up this tick.
+    void evictDead() {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.generation != generation) {
+                closeEntry(it->second);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void closeFd(int &fd) {
+        if (fd < 0) return;
+        if (ring) ring->unregisterFile(fd);
+        close(fd);
+        countSyscalls(1);
+        fd = -1;
+        --openFds;
+    }
+
+    void closeEntry(Entry &entry) {
+        closeFd(entry.statFd);
+        closeFd(entry.statusFd);
+        closeFd(entry.ioFd);
+    }
+};
+
+// Parses an unsigned decimal at p, skipping leading blanks, and advances p past it.
+unsigned long long scanNumber(const char *&p) {
+    while (*p == ' ') ++p;
+    unsigned long long value = 0;
+    while (*p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+    return value;
+}
+
+// Advances p past count space-separated fields.
+void skipFields(const char *&p, int count) {
+    for (int i = 0; i < count; ++i) {
+        while (*p == ' ') ++p;
+        while (*p && *p != ' ') ++p;
+    }
+}
+
+// The handful of /proc/<pid>/stat fields the monitor uses.
+struct StatFields {
+    const char *comm;  // points into the parsed buffer, not NUL-terminated
+    size_t commLen;
+    char state;
+    unsigned long long utime, stime, numThreads, startTime, vsize, rssPages;
+};
+
+// Parses a /proc/<pid>/stat line in place without allocating.
+bool parseStat(const char *buf, size_t len, StatFields &out) {
+    const char *commStart = static_cast<const char *>(memchr(buf, '(', len));
+    const char *commEnd = static_cast<const char *>(memrchr(buf, ')', len));
+    if (!commStart || !commEnd || commEnd < commStart) return false;
+    out.comm = commStart + 1;
+    out.commLen = commEnd - commStart - 1;
+
+    // comm may contain spaces or parentheses, so fields restart after the last ')'
+    const char *p = commEnd + 1;
+    while (*p == ' ') ++p;
+    out.state = *p;
+    skipFields(p, 11);  // state .. cmajflt (fields 3-13)
+    out.utime = scanNumber(p);
+    out.stime = scanNumber(p);
+    skipFields(p, 4);  // cutime .. nice (fields 16-19)
+    out.numThreads = scanNumber(p);
+    skipFields(p, 1);  // itrealvalue
+    out.startTime = scanNumber(p);
+    out.vsize = scanNumber(p);
+    out.rssPages = scanNumber(p);
+    return true;
+}
+
+// Sums the jiffy fields of the aggregate "cpu" line at the top of /proc/stat.
+bool readTotalJiffies(unsigned long long &total) {
+    char buf[4096], path[128];
+    snprintf(path, sizeof(path), "%s/stat", procRoot);
+    if (readProcFile(path, buf, sizeof(buf)) <= 0) return false;
+    if (strncmp(buf, "cpu ", 4) != 0) return false;
+
+    const char *p = buf + 4;
+    total = 0;
+    // user nice system idle iowait irq softirq steal; guest time is already in user
+    for (int i = 0; i < 8; ++i) total += scanNumber(p);
+    return true;
+}
+
+// Reads a "Key:\t  value kB" entry from a /proc/<pid>/status buffer, or 0 if absent.
+long statusValue(const char *buf, const char *key) {
+    const char *line = strstr(buf, key);
+    if (!line) return 0;  // kernel threads have no Vm* lines
+    const char *p = line + strlen(key);
+    while (*p == '\t' || *p == ' ') ++p;
+    return (long)scanNumber(p);
+}
+
+// Fields only available from /proc/<pid>/status, read when SampleOptions::readStatus is set.
+struct StatusFields {
+    long rssKb;
+    long swapKb;
+};
+
+bool readStatusFields(FdCache &fds, FdCache::Entry &entry, int pid, StatusFields &out) {
+    char buf[4096];
+    if (fds.read(entry.statusFd, pid, "status", buf, sizeof(buf)) < 0) return false;
+    ParseTimer timer;
+    out.rssKb = statusValue(buf, "\nVmRSS:");
+    out.swapKb = statusValue(buf, "\nVmSwap:");
+    return true;
+}
+
+// Reads rchar, wchar, read_bytes and write_bytes from /proc/<pid>/io. A
+// process we may not ptrace refuses; that's remembered for its lifetime.
+bool readIoCounters(FdCache &fds, FdCache::Entry &entry, int pid, uint64_t out[4]) {
+    if (entry.ioDenied) return false;
+    char buf[512];
+    if (fds.read(entry.ioFd, pid, "io", buf, sizeof(buf)) < 0) {
+        if (errno == EACCES || errno == EPERM) entry.ioDenied = true;
+        return false;
+    }
+    // rchar wchar syscr syscw read_bytes write_bytes cancelled_write_bytes, one per line in that order
+    ParseTimer timer;
+    uint64_t values[6] = {};
+    const char *p = buf;
+    for (uint64_t &value : values) {
+        p = strchr(p, ':');
+        if (!p) return false;
+        ++p;
+        value = scanNumber(p);
+    }
+    out[0] = values[0];
+    out[1] = values[1];
+    out[2] = values[4];
+    out[3] = values[5];
+    return true;
+}
+
+// Value columns that printProcessList and the JSONL/CSV exporters can show,
+// picked with --columns. PID and NAME (and the exports' ts and start) are
+// always there. Each spec names the /proc/<pid> files beyond stat the
+// column needs, so a pass only opens what the enabled columns read.
+enum class Column : uint8_t { Cpu, Rss, Swap, Vsz, Threads, State, DiskRead, DiskWrite, Rchar, Wchar, Count };
+
+enum ColumnReads : unsigned { ReadsStatus = 1 << 0, ReadsIo = 1 << 1 };
+
+struct ColumnSpec {
+    const char *key;     // --columns name
+    const char *field;   // JSONL/CSV field
+    const char *header;  // TUI heading; cells are right-aligned to width
+    int width;
+    unsigned reads;  // ColumnReads bits
+};
+
+constexpr ColumnSpec kColumnSpecs[] = {
+    {"cpu", "cpu", "CPU%", 6, 0},
+    {"rss", "rss_kb", "RAM(KB)", 11, 0},
+    {"swap", "swap_kb", "SWAP(KB)", 11, ReadsStatus},
+    {"vsz", "vsz_kb", "VSZ(KB)", 11, 0},
+    {"threads", "threads", "THR", 4, 0},
+    {"state", "state", "S", 1, 0},
+    {"read", "read_bps", "RD(KB/s)", 9, ReadsIo},
+    {"write", "write_bps", "WR(KB/s)", 9, ReadsIo},
+    {"rchar", "rchar_bps", "RCHAR(KB/s)", 11, ReadsIo},
+    {"wchar", "wchar_bps", "WCHAR(KB/s)", 11, ReadsIo},
+};
+static_assert(sizeof(kColumnSpecs) / sizeof(kColumnSpecs[0]) == (size_t)Column::Count, "one spec per column");
+
+constexpr uint32_t columnBit(Column column) { return 1u << (unsigned)column; }
+constexpr const ColumnSpec &columnSpec(Column column) { return kColumnSpecs[(size_t)column]; }
+
+// The files the columns in the mask read between them.
+constexpr unsigned columnReads(uint32_t columns) {
+    unsigned reads = 0;
+    for (size_t i = 0; i < (size_t)Column::Count; ++i)
+        if (columns & (1u << i)) reads |= kColumnSpecs[i].reads;
+    return reads;
+}
+
+constexpr uint32_t kDefaultColumns = columnBit(Column::Cpu) | columnBit(Column::Rss);
+static_assert(columnReads(kDefaultColumns) == 0, "the default columns come from stat alone");
+
+// Calls f with each column in the mask, in display order.
+template <typename F>
+void forEachColumn(uint32_t columns, F f) {
+    for (uint32_t rest = columns; rest; rest &= rest - 1) f(Column(__builtin_ctz(rest)));
+}
+
+// Parses a comma-separated --columns list; false on an unknown name.
+bool parseColumns(const std::string &list, uint32_t &columns) {
+    columns = 0;
+    for (size_t start = 0; start <= list.size();) {
+        size_t end = std::min(list.find(',', start), list.size());
+        std::string key = list.substr(start, end - start);
+        size_t i = 0;
+        while (i < (size_t)Column::Count && key != kColumnSpecs[i].key) ++i;
+        if (i == (size_t)Column::Count) return false;
+        columns |= 1u << i;
+        start = end + 1;
+    }
+    return true;
+}
+
+// Knobs for a getProcessList pass.
+struct SampleOptions {
+    uint32_t columns = kDefaultColumns;
+    bool readStatus = false;  // also read /proc/<pid>/status for VmRSS/VmSwap; set when a column needs it
+    unsigned threads = 0;     // sampling workers; 0 means hardware_concurrency
+    std::string backend = "proc";  // "proc", "netlink", "io_uring" or "bpf"
+    // Pushed down by the bpf backend: the name filter, and a cap on rows per
+    // tick (the busiest first; 0 for all). --aggregate merges this many rows
+    // across hosts, 100 by default.
+    std::string filter;
+    size_t topK = 0;
+};
+
+// Fixed set of threads that run one job per call to run(). The calling
+// thread acts as worker 0, so a pool of size 1 starts no threads at all.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned count) : count(count ? count : 1) {
+        for (unsigned i = 1; i < this->count; ++i) threads.emplace_back(&WorkerPool::workerLoop, this, i);
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads) t.join();
+    }
+
+    unsigned size() const { return count; }
+
+    // Runs job(index) on every worker and returns once all of them finish.
+    void run(const std::function<void(unsigned)> &job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            pending = count - 1;
+            ++round;
+        }
+        wake.notify_all();
+        job(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return pending == 0; });
+        current = nullptr;
+    }
+
+private:
+    void workerLoop(unsigned index) {
+        profiler.attach(("worker " + std::to_string(index)).c_str());
+        unsigned long seen = 0;
+        while (true) {
+            const std::function<void(unsigned)> *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || round != seen; });
+                if (stopping) return;
+                seen = round;
+                job = current;
+            }
+            (*job)(index);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+    unsigned count;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(unsigned)> *current = nullptr;
+    unsigned long round = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+};
+
+// One worker's slice of the process table. Pids are assigned to shards by
+// pid % shard count, so each shard owns the history for its pids outright
+// and workers never touch each other's data.
+struct SampleShard {
+    // Recycles hash nodes of exited processes for new ones, so churn doesn't reach the heap
+    std::pmr::unsynchronized_pool_resource nodes;
+    std::vector<int> pids;
+    ProcessTable procs;
+    CpuHistory history{&nodes};
+    FdCache fds{&nodes};
+    NamePool *names = nullptr;  // shared by all shards
+    bool readIo = false;  // this tick also reads /proc/<pid>/io
+    double now = 0;       // steady clock seconds at the start of the tick
+};
+
+// Raises the soft descriptor limit to the hard one and returns how many
+// descriptors the fd caches may hold in total, leaving headroom for the rest
+// of the program.
+size_t fdCacheBudget() {
+    const rlim_t reserve = 64;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    if (limit.rlim_cur < limit.rlim_max) {
+        struct rlimit raised = limit;
+        raised.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &raised) == 0) limit = raised;
+    }
+    return limit.rlim_cur > reserve ? limit.rlim_cur - reserve : 0;
+}
+
+void beginShard(SampleShard &shard) {
+    shard.now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    ++shard.history.generation;
+    ++shard.fds.generation;
+    shard.procs.clear();
+}
+
+void endShard(SampleShard &shard) {
+    shard.history.evictDead();
+    shard.fds.evictDead();
+}
+
+// Turns one process's stat contents (plus status, when enabled) into a row
+// in the shard's procs. len is the read result; failures are skipped.
+void recordProcess(SampleShard &shard, const SampleOptions &options, unsigned long long elapsedJiffies, int pid,
+                   FdCache::Entry &entry, const char *statBuf, ssize_t len) {
+    static const long pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    countProcsScanned();
+    if (len <= 0) return;
+
+    // An idle process's stat is byte-for-byte what it was last tick: same
+    // counters and RSS, so skip parsing (and status and io) and repeat the row
+    // at 0% CPU and no I/O. The whole line is compared, since a row that
+    // only looked unchanged would stay frozen.
+    if (entry.lastStat.size() == (size_t)len && memcmp(entry.lastStat.data(), statBuf, len) == 0) {
+        if (CpuHistory::Sample *sample = shard.history.touch({pid, entry.startTime})) {
+            shard.procs.push(pid, 0.0, sample->rssKb, sample->swapKb, entry.startTime, sample->nameId, !sample->idle,
+                             sample->details);
+            sample->idle = true;
+            return;
+        }
+    }
+
+    StatFields stat;
+    {
+        ParseTimer timer;
+        if (!parseStat(statBuf, len, stat)) return;
+    }
+    entry.startTime = stat.startTime;
+    // Counters gain digits over time; room for a few keeps the copy from reallocating
+    if (entry.lastStat.capacity() < (size_t)len) entry.lastStat.reserve(len + 32);
+    entry.lastStat.assign(statBuf, len);
+
+    unsigned long long used;
+    CpuHistory::Sample &sample = shard.history.update({pid, stat.startTime}, stat.utime + stat.stime, used);
+    double cpuUsage = elapsedJiffies == 0 ? 0.0 : (double)used / elapsedJiffies * 100.0;
+
+    // Only a new process, or one that exec'd or renamed itself, touches the pool
+    if (!sample.name || sample.name->size() != stat.commLen ||
+        memcmp(sample.name->data(), stat.comm, stat.commLen) != 0) {
+        sample.nameId = shard.names->intern(stat.comm, stat.commLen);
+        sample.name = &shard.names->name(sample.nameId);
+    }
+
+    // stat's rss field matches VmRSS, so status is only opened on request
+    uint64_t ramUsage = stat.rssPages * pageKb;
+    uint64_t swapUsage = 0;
+    if (options.readStatus) {
+        StatusFields status;
+        if (!readStatusFields(shard.fds, entry, pid, status)) return;
+        ramUsage = status.rssKb;
+        swapUsage = status.swapKb;
+    }
+
+    // I/O rates average over the time since io was last read, which spans
+    // any ticks the unchanged-stat shortcut skipped
+    IoRates io;
+    uint64_t counters[4];
+    if (shard.readIo && readIoCounters(shard.fds, entry, pid, counters)) {
+        double seconds = shard.now - sample.ioTime;
+        if (sample.ioTime > 0 && seconds > 0) {
+            auto rate = [&](int i) {
+                return counters[i] >= sample.ioCounters[i] ? (uint64_t)((counters[i] - sample.ioCounters[i]) / seconds) : 0;
+            };
+            io = {rate(2), rate(3), rate(0), rate(1)};
+        }
+        memcpy(sample.ioCounters, counters, sizeof(counters));
+        sample.ioTime = shard.now;
+    }
+
+    sample.rssKb = ramUsage;
+    sample.swapKb = swapUsage;
+    sample.details.vszKb = stat.vsize / 1024;
+    sample.details.threads = (uint32_t)stat.numThreads;
+    sample.details.state = stat.state;
+    sample.idle = cpuUsage == 0.0 && !io.readBps && !io.writeBps && !io.rcharBps && !io.wcharBps;
+    shard.procs.push(pid, cpuUsage, ramUsage, swapUsage, stat.startTime, sample.nameId, true, sample.details, io);
+}
+
+// Samples every pid in the shard's bucket into its procs vector.
+void sampleShard(SampleShard &shard, const SampleOptions &options, unsigned long long elapsedJiffies) {
+    beginShard(shard);
+    char statBuf[1024];
+    for (int pid : shard.pids) {
+        FdCache::Entry &entry = shard.fds.lookup(pid);
+        ssize_t len = shard.fds.read(entry.statFd, pid, "stat", statBuf, sizeof(statBuf));
+        recordProcess(shard, options, elapsedJiffies, pid, entry, statBuf, len);
+    }
+    endShard(shard);
+}
+
+// Source of process tables; getProcessList delegates to one of these.
+class SamplerBackend {
+public:
+    virtual ~SamplerBackend() = default;
+    virtual const char *name() const = 0;
+    // Replaces procs with the current process table.
+    virtual bool sample(ProcessTable &procs) = 0;
+
+    unsigned long long ticks = 0;  // passes so far; getProcessList stamps tables with it
+    // ColumnReads wanted on top of what the columns read, e.g. io for the
+    // sort key; may be set from another thread and applies from the next pass
+    std::atomic<unsigned> extraReads{0};
+};
+
+// Polls /proc: every tick enumerates the numeric entries of /proc and reads
+// each process's stat file across the worker pool.
+class ProcScanner : public SamplerBackend {
+public:
+    explicit ProcScanner(const SampleOptions &opts)
+        : options(opts),
+          pool(opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency())),
+          shards(pool.size()) {
+        size_t perShard = fdCacheBudget() / shards.size();
+        for (auto &shard : shards) {
+            shard.fds.maxFds = perShard;
+            shard.names = &names;
+        }
+    }
+
+    ~ProcScanner() override {
+        if (procDirFd >= 0) close(procDirFd);
+    }
+
+    const char *name() const override { return "proc"; }
+
+    bool sample(ProcessTable &procs) override {
+        if (!beginTick()) return false;
+        clearPids();
+        if (!listProcDir()) return false;
+        scanPids(procs);
+        return true;
+    }
+
+protected:
+    // Reads the aggregate jiffies and works out how many elapsed since the last tick.
+    bool beginTick() {
+        tickArena.reset();
+        bool readIo = (columnReads(options.columns) | extraReads.load(std::memory_order_relaxed)) & ReadsIo;
+        for (auto &shard : shards) shard.readIo = readIo;
+        unsigned long long totalJiffies;
+        if (!readTotalJiffies(totalJiffies)) return false;
+        // The first tick has nothing to diff against, so every process reads 0%
+        elapsedJiffies = prevTotalJiffies ? totalJiffies - prevTotalJiffies : 0;
+        prevTotalJiffies = totalJiffies;
+        return true;
+    }
+
+    void clearPids() {
+        for (auto &shard : shards) shard.pids.clear();
+    }
+
+    void addPid(int pid) { shards[pid % shards.size()].pids.push_back(pid); }
+
+    // Lists /proc with getdents64 on a descriptor kept open across ticks,
+    // into a buffer allocated once, instead of an opendir() per tick.
+    bool listProcDir() {
+        if (procDirFd < 0) procDirFd = open(procRoot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procDirFd < 0 || lseek(procDirFd, 0, SEEK_SET) != 0) return false;
+        countSyscalls(1);
+        while (true) {
+            long len = syscall(SYS_getdents64, procDirFd, direntBuf.data(), direntBuf.size());
+            countSyscalls(1, len);
+            if (len < 0) return false;
+            if (len == 0) return true;
+            for (long pos = 0; pos < len;) {
+                const struct dirent64 *entry = reinterpret_cast<const struct dirent64 *>(direntBuf.data() + pos);
+                int pid = parsePid(entry->d_name);
+                if (pid > 0) addPid(pid);
+                pos += entry->d_reclen;
+            }
+        }
+    }
+
+    // Samples the queued pids and merges the shards into procs.
+    void scanPids(ProcessTable &procs) {
+        pool.run([&](unsigned index) { sampleShardAt(index); });
+
+        procs.clear();
+        procs.names = &names;
+        size_t total = 0;
+        for (const auto &shard : shards) total += shard.procs.size();
+        procs.reserve(total);
+        for (const auto &shard : shards) procs.append(shard.procs);
+    }
+
+    // Runs on worker `index` to fill shards[index].procs from its pid bucket.
+    virtual void sampleShardAt(unsigned index) { sampleShard(shards[index], options, elapsedJiffies); }
+
+    // utime + stime recorded for a process on the last tick, or 0 if unknown.
+    unsigned long long lastTicks(int pid, unsigned long long startTime) const {
+        const CpuHistory &history = shards[pid % shards.size()].history;
+        auto it = history.samples.find({pid, startTime});
+        return it == history.samples.end() ? 0 : it->second.ticks;
+    }
+
+    SampleOptions options;
+    WorkerPool pool;
+    NamePool names;
+    std::vector<SampleShard> shards;
+    // Scratch that lives for one sample() call; today only the netlink
+    // backend's exit map. The scan's other containers are cleared, not
+    // freed, between ticks, so they stop allocating once grown; the name
+    // filter's memo outlives a tick, so it stays in NameFilter
+    Arena tickArena;
+    int procDirFd = -1;
+    std::vector<char> direntBuf = std::vector<char>(32 << 10);
+    unsigned long long prevTotalJiffies = 0;
+    unsigned long long elapsedJiffies = 0;
+};
+
+// Event-driven sampler for hosts with heavy process churn. The netlink proc
+// connector reports fork/exec/exit as they happen, so the live pid set is
+// kept up to date without listing /proc, and taskstats exit records carry
+// the final CPU time of processes that came and went between two ticks.
+// Live processes are still read through the same stat/fd-cache path.
+class NetlinkSampler : public ProcScanner {
+public:
+    explicit NetlinkSampler(const SampleOptions &opts) : ProcScanner(opts) {}
+
+    ~NetlinkSampler() override {
+        if (connectorFd >= 0) close(connectorFd);
+        if (taskstatsFd >= 0) close(taskstatsFd);
+    }
+
+    const char *name() const override { return "netlink"; }
+
+    // Opens and subscribes both sockets; false (with errno set) if the kernel
+    // lacks them or we don't have CAP_NET_ADMIN.
+    bool open() { return openConnector() && openTaskstats(); }
+
+    bool sample(ProcessTable &procs) override {
+        if (!beginTick()) return false;
+        ExitMap exited(&tickArena);
+        drainConnector();
+        drainTaskstats(exited);
+        // Before the scan evicts them: exited pids aren't rescanned, so their
+        // history would be gone by the time the exits are accounted below
+        for (auto &kv : exited) {
+            auto it = live.find(kv.first);
+            if (it != live.end()) kv.second.prevTicks = lastTicks(kv.first, it->second);
+        }
+
+        clearPids();
+        if (resync) {
+            // First tick, or the socket overflowed and events were lost
+            if (!listProcDir()) return false;
+            resync = false;
+        } else {
+            for (const auto &kv : live) {
+                if (!exited.count(kv.first)) addPid(kv.first);
+            }
+        }
+        scanPids(procs);
+
+        // Processes gone since the last tick: report the CPU they used in the
+        // interval up to their exit, then forget them.
+        static const double usecPerTick = 1e6 / sysconf(_SC_CLK_TCK);
+        for (const auto &kv : exited) {
+            const ExitRecord &record = kv.second;
+            auto it = live.find(kv.first);
+            unsigned long long startTime = it == live.end() ? 0 : it->second;
+            unsigned long long ticks = (unsigned long long)(record.cpuUsec / usecPerTick);
+            unsigned long long used = ticks > record.prevTicks ? ticks - record.prevTicks : 0;
+            double cpuUsage = elapsedJiffies == 0 ? 0.0 : (double)used / elapsedJiffies * 100.0;
+            procs.push(kv.first, cpuUsage, 0, 0, startTime, names.intern(record.name, strnlen(record.name, sizeof(record.name))));
+        }
+
+        live.clear();
+        for (size_t row = 0; row < procs.size(); ++row) {
+            if (!exited.count(procs.pid[row])) live[procs.pid[row]] = procs.startTime[row];
+        }
+        return true;
+    }
+
+private:
+    struct ExitRecord {
+        char name[TS_COMM_LEN];
+        unsigned long long cpuUsec;
+        unsigned long long prevTicks;  // utime + stime as of the last tick, 0 if it never got scanned
+    };
+
+    // Exits reported during one tick; lives in the tick arena
+    using ExitMap = std::pmr::unordered_map<int, ExitRecord>;
+
+    bool openConnector() {
+        connectorFd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (connectorFd < 0) return false;
+        int bufSize = 4 << 20;
+        setsockopt(connectorFd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+
+        struct sockaddr_nl addr = {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        if (bind(connectorFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) return false;
+
+        alignas(struct nlmsghdr) char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))] = {};
+        struct nlmsghdr *header = (struct nlmsghdr *)request;
+        struct cn_msg *message = (struct cn_msg *)NLMSG_DATA(header);
+        enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(*message) + sizeof(op));
+        header->nlmsg_type = NLMSG_DONE;
+        header->nlmsg_pid = getpid();
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(op);
+        memcpy(message->data, &op, sizeof(op));
+        return send(connectorFd, request, header->nlmsg_len, 0) == (ssize_t)header->nlmsg_len;
+    }
+
+    // Sends a generic netlink request carrying one attribute.
+    bool sendGenl(uint16_t family, uint8_t cmd, uint16_t attrType, const void *data, size_t len) {
+        char buf[256] = {};
+        struct nlmsghdr *header = (struct nlmsghdr *)buf;
+        struct genlmsghdr *genl = (struct genlmsghdr *)NLMSG_DATA(header);
+        struct nlattr *attr = (struct nlattr *)((char *)genl + GENL_HDRLEN);
+        if (NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + len) > sizeof(buf)) return false;
+
+        attr->nla_type = attrType;
+        attr->nla_len = NLA_HDRLEN + len;
+        memcpy((char *)attr + NLA_HDRLEN, data, len);
+        genl->cmd = cmd;
+        genl->version = 1;
+        header->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_ALIGN(attr->nla_len));
+        header->nlmsg_type = family;
+        header->nlmsg_flags = NLM_F_REQUEST;
+        header->nlmsg_pid = getpid();
+        return send(taskstatsFd, buf, header->nlmsg_len, 0) == (ssize_t)header->nlmsg_len;
+    }
+
+    bool openTaskstats() {
+        taskstatsFd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+        if (taskstatsFd < 0) return false;
+        int bufSize = 4 << 20;
+        setsockopt(taskstatsFd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+        struct timeval timeout = {1, 0};
+        setsockopt(taskstatsFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        struct sockaddr_nl addr = {};
+        addr.nl_family = AF_NETLINK;
+        if (bind(taskstatsFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) return false;
+
+        // Resolve the TASKSTATS family id
+        if (!sendGenl(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+                      sizeof(TASKSTATS_GENL_NAME))) {
+            return false;
+        }
+        char buf[4096];
+        ssize_t len = recv(taskstatsFd, buf, sizeof(buf), 0);
+        struct nlmsghdr *header = (struct nlmsghdr *)buf;
+        if (len <= 0 || !NLMSG_OK(header, (size_t)len) || header->nlmsg_type == NLMSG_ERROR) {
+            errno = len < 0 ? errno : ENOENT;
+            return false;
+        }
+        int attrsLen = header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        struct nlattr *attr = (struct nlattr *)((char *)NLMSG_DATA(header) + GENL_HDRLEN);
+        for (; attrsLen >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN;
+             attrsLen -= NLA_ALIGN(attr->nla_len), attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len))) {
+            if (attr->nla_type == CTRL_ATTR_FAMILY_ID) memcpy(&family, (char *)attr + NLA_HDRLEN, sizeof(family));
+        }
+        if (!family) {
+            errno = ENOENT;
+            return false;
+        }
+
+        // Ask for an exit record from every CPU
+        char cpumask[32];
+        snprintf(cpumask, sizeof(cpumask), "0-%d", get_nprocs_conf() - 1);
+        if (!sendGenl(family, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpumask, strlen(cpumask) + 1)) {
+            return false;
+        }
+        return fcntl(taskstatsFd, F_SETFL, O_NONBLOCK) == 0;
+    }
+
+    void drainConnector() {
+        alignas(struct nlmsghdr) char buf[16384];
+        while (true) {
+            ssize_t len = recv(connectorFd, buf, sizeof(buf), 0);
+            countSyscalls(1, len);
+            if (len < 0) {
+                if (errno == ENOBUFS) {
+                    resync = true;  // events were dropped; fall back to one full scan
+                    continue;
+                }
+                return;  // EAGAIN: drained
+            }
+            for (struct nlmsghdr *header = (struct nlmsghdr *)buf; NLMSG_OK(header, (size_t)len);
+                 header = NLMSG_NEXT(header, len)) {
+                struct cn_msg *message = (struct cn_msg *)NLMSG_DATA(header);
+                const struct proc_event *event = (const struct proc_event *)message->data;
+                switch (event->what) {
+                case proc_event::PROC_EVENT_FORK:
+                    // Thread creation also shows up as a fork; only new thread groups matter
+                    if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+                        live.emplace(event->event_data.fork.child_tgid, 0);
+                    }
+                    break;
+                case proc_event::PROC_EVENT_EXEC:
+                    live.emplace(event->event_data.exec.process_tgid, 0);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    void drainTaskstats(ExitMap &exited) {
+        alignas(struct nlmsghdr) char buf[16384];
+        while (true) {
+            ssize_t len = recv(taskstatsFd, buf, sizeof(buf), 0);
+            countSyscalls(1, len);
+            if (len < 0) {
+                if (errno == ENOBUFS) {
+                    resync = true;
+                    continue;
+                }
+                return;
+            }
+            for (struct nlmsghdr *header = (struct nlmsghdr *)buf; NLMSG_OK(header, (size_t)len);
+                 header = NLMSG_NEXT(header, len)) {
+                if (header->nlmsg_type != family) continue;
+                parseExitMessage(header, exited);
+            }
+        }
+    }
+
+    // Records the tgid-level CPU time from a taskstats exit notification.
+    // Multi-threaded groups get a TGID aggregate when the last thread exits;
+    // single-threaded ones only get the PID record of their one thread.
+    void parseExitMessage(struct nlmsghdr *header, ExitMap &exited) {
+        int remaining = header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        struct nlattr *attr = (struct nlattr *)((char *)NLMSG_DATA(header) + GENL_HDRLEN);
+        for (; remaining >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN;
+             remaining -= NLA_ALIGN(attr->nla_len), attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len))) {
+            if (attr->nla_type != TASKSTATS_TYPE_AGGR_PID && attr->nla_type != TASKSTATS_TYPE_AGGR_TGID) continue;
+            bool groupTotal = attr->nla_type == TASKSTATS_TYPE_AGGR_TGID;
+
+            int nested = attr->nla_len - NLA_HDRLEN;
+            struct nlattr *inner = (struct nlattr *)((char *)attr + NLA_HDRLEN);
+            uint32_t id = 0;
+            for (; nested >= NLA_HDRLEN && inner->nla_len >= NLA_HDRLEN;
+                 nested -= NLA_ALIGN(inner->nla_len),
+                 inner = (struct nlattr *)((char *)inner + NLA_ALIGN(inner->nla_len))) {
+                const char *payload = (const char *)inner + NLA_HDRLEN;
+                if (inner->nla_type == TASKSTATS_TYPE_PID || inner->nla_type == TASKSTATS_TYPE_TGID) {
+                    memcpy(&id, payload, sizeof(id));
+                } else if (inner->nla_type == TASKSTATS_TYPE_STATS) {
+                    struct taskstats stats;
+                    memset(&stats, 0, sizeof(stats));
+                    memcpy(&stats, payload, std::min(sizeof(stats), (size_t)inner->nla_len - NLA_HDRLEN));
+                    // A non-leader thread exiting isn't the process exiting
+                    if (!groupTotal && stats.version >= 12 && stats.ac_tgid && stats.ac_tgid != id) continue;
+                    auto inserted = exited.try_emplace(id);
+                    ExitRecord &record = inserted.first->second;
+                    if (groupTotal || inserted.second) {
+                        memcpy(record.name, stats.ac_comm, sizeof(record.name));
+                        record.cpuUsec = stats.ac_utime + stats.ac_stime;
+                    }
+                }
+            }
+        }
+    }
+
+    int connectorFd = -1;
+    int taskstatsFd = -1;
+    uint16_t family = 0;
+    bool resync = true;
+    std::pmr::unsynchronized_pool_resource liveNodes;
+    std::pmr::unordered_map<int, unsigned long long> live{&liveNodes};  // tgid -> start time (0 until first read)
+};
+
+// /proc polling with the per-process stat reads of each shard batched into
+// io_uring submissions: up to IoRing::kEntries reads go out in a single
+// io_uring_enter, into registered buffers, through fixed files mirrored
+// from the fd cache. Processes without a cached descriptor take the
+// synchronous path.
+class IoUringScanner : public ProcScanner {
+public:
+    explicit IoUringScanner(const SampleOptions &opts) : ProcScanner(opts), rings(shards.size()) {}
+
+    ~IoUringScanner() override {
+        // The rings go away before the base class closes the cached descriptors
+        for (auto &shard : shards) shard.fds.ring = nullptr;
+    }
+
+    const char *name() const override { return "io_uring"; }
+
+    bool open() {
+        for (size_t i = 0; i < rings.size(); ++i) {
+            rings[i] = std::make_unique<IoRing>();
+            unsigned fileSlots = (unsigned)std::min<size_t>(shards[i].fds.maxFds + 1024, 1 << 16);
+            if (!rings[i]->init(fileSlots)) return false;
+            shards[i].fds.ring = rings[i].get();
+        }
+        return true;
+    }
+
+protected:
+    void sampleShardAt(unsigned index) override {
+        SampleShard &shard = shards[index];
+        IoRing &ring = *rings[index];
+        FdCache &fds = shard.fds;
+        beginShard(shard);
+
+        int results[IoRing::kEntries];
+        FdCache::Entry *batchEntries[IoRing::kEntries];
+        int batchPids[IoRing::kEntries];
+        unsigned batched = 0;
+        char statBuf[IoRing::kSlotSize];
+
+        auto flush = [&] {
+            if (!batched) return;
+            if (!ring.submitAndWait(results)) {
+                for (unsigned i = 0; i < batched; ++i) results[i] = -EIO;
+            }
+            for (unsigned i = 0; i < batched; ++i) {
+                FdCache::Entry &entry = *batchEntries[i];
+                if (results[i] >= 0) {
+                    char *buf = ring.slot(i);
+                    buf[results[i]] = '\0';
+                    recordProcess(shard, options, elapsedJiffies, batchPids[i], entry, buf, results[i]);
+                } else {
+                    // ESRCH: exited, or the pid was reused; retry through a fresh open
+                    fds.closeFd(entry.statFd);
+                    ssize_t len = fds.read(entry.statFd, batchPids[i], "stat", statBuf, sizeof(statBuf));
+                    recordProcess(shard, options, elapsedJiffies, batchPids[i], entry, statBuf, len);
+                }
+            }
+            batched = 0;
+        };
+
+        for (int pid : shard.pids) {
+            FdCache::Entry &entry = fds.lookup(pid);
+            if (!fds.openCached(entry.statFd, pid, "stat")) {
+                ssize_t len = fds.read(entry.statFd, pid, "stat", statBuf, sizeof(statBuf));
+                recordProcess(shard, options, elapsedJiffies, pid, entry, statBuf, len);
+                continue;
+            }
+            batchEntries[batched] = &entry;
+            batchPids[batched] = pid;
+            ring.queueRead(entry.statFd, batched);
+            if (++batched == IoRing::kEntries) flush();
+        }
+        flush();
+        endShard(shard);
+    }
+
+private:
+    std::vector<std::unique_ptr<IoRing>> rings;  // one per shard, used only by its worker
+};
+
+// Substring search tuned for short command names. SSE2 compares the
+// needle's first and last bytes at 16 candidate offsets per step, and only
+// offsets where both match are confirmed with memcmp. The text is copied
+// into a zero-padded buffer so the vector loads never run past its end.
+bool containsSubstring(const char *text, size_t len, const char *needle, size_t n) {
+    if (n == 0) return true;
+    if (n > len) return false;
+#ifdef __SSE2__
+    char padded[256];
+    if (len + 16 > sizeof(padded)) return memmem(text, len, needle, n) != nullptr;
+    memcpy(padded, text, len);
+    memset(padded + len, 0, 16);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    size_t positions = len - n + 1;
+    for (size_t i = 0; i < positions; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(padded + i));
+        __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i *>(padded + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+                                                        _mm_cmpeq_epi8(last, blockLast)));
+        if (positions - i < 16) mask &= (1u << (positions - i)) - 1;
+        while (mask) {
+            unsigned offset = __builtin_ctz(mask);
+            if (memcmp(padded + i + offset, needle, n) == 0) return true;
+            mask &= mask - 1;
+        }
+    }
+    return false;
+#else
+    return memmem(text, len, needle, n) != nullptr;
+#endif
+}
+
+// A name filter compiled once when it's entered. "^abc" matches names that
+// start with abc, "~expr" is an ECMAScript regex, and anything else is a
+// plain substring.
+class NameMatcher {
+public:
+    // Compiles pattern; on failure returns false and leaves the matcher unchanged.
+    bool compile(const std::string &pattern, std::string &error) {
+        Kind newKind = Kind::Substring;
+        std::string body = pattern;
+        if (pattern.empty()) newKind = Kind::All;
+        else if (pattern[0] == '^') newKind = Kind::Prefix, body = pattern.substr(1);
+        else if (pattern[0] == '~') newKind = Kind::Regex, body = pattern.substr(1);
+
+        if (newKind == Kind::Regex) {
+            try {
+                regex.assign(body, std::regex::ECMAScript | std::regex::optimize);
+            } catch (const std::regex_error &e) {
+                error = e.what();
+                return false;
+            }
+        }
+        kind = newKind;
+        needle = body;
+        return true;
+    }
+
+    bool matchesAll() const { return kind == Kind::All; }
+
+    bool matches(const std::string &name) const {
+        switch (kind) {
+        case Kind::All: return true;
+        case Kind::Substring: return containsSubstring(name.data(), name.size(), needle.data(), needle.size());
+        case Kind::Prefix: return name.size() >= needle.size() && memcmp(name.data(), needle.data(), needle.size()) == 0;
+        case Kind::Regex: return std::regex_search(name, regex);
+        }
+        return false;
+    }
+
+private:
+    enum class Kind { All, Substring, Prefix, Regex };
+    Kind kind = Kind::All;
+    std::string needle;
+    std::regex regex;
+};
+
+// Minimal assembler for the eBPF programs below: emits instructions into a
+// vector and patches forward jumps once their target is known.
+class BpfAssembler {
+public:
+    void movImm(uint8_t dst, int32_t imm) { emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm); }
+    void movReg(uint8_t dst, uint8_t src) { emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0); }
+    void mov32Reg(uint8_t dst, uint8_t src) { emit(BPF_ALU | BPF_MOV | BPF_X, dst, src, 0, 0); }  // zero-extends
+    void aluImm(uint8_t op, uint8_t dst, int32_t imm) { emit(BPF_ALU64 | op | BPF_K, dst, 0, 0, imm); }
+    void aluReg(uint8_t op, uint8_t dst, uint8_t src) { emit(BPF_ALU64 | op | BPF_X, dst, src, 0, 0); }
+    void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off) { emit(BPF_LDX | size | BPF_MEM, dst, src, off, 0); }
+    void store(uint8_t size, uint8_t dst, int16_t off, uint8_t src) { emit(BPF_STX | size | BPF_MEM, dst, src, off, 0); }
+    void storeImm(uint8_t size, uint8_t dst, int16_t off, int32_t imm) { emit(BPF_ST | size | BPF_MEM, dst, 0, off, imm); }
+    void atomicAdd(uint8_t dst, int16_t off, uint8_t src) { emit(BPF_STX | BPF_DW | BPF_XADD, dst, src, off, 0); }
+    void call(int32_t helper) { emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+    void exit() { emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0); }
+
+    void loadMap(uint8_t dst, int mapFd) {
+        emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, mapFd);
+        emit(0, 0, 0, 0, 0);  // upper half of the 64-bit immediate
+    }
+
+    // Conditional jumps to a target bound later; return the jump's index for bind().
+    size_t jumpImm(uint8_t op, uint8_t reg, int32_t imm) {
+        emit(BPF_JMP | op | BPF_K, reg, 0, 0, imm);
+        return insns.size() - 1;
+    }
+    size_t jumpReg(uint8_t op, uint8_t dst, uint8_t src) {
+        emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+        return insns.size() - 1;
+    }
+    size_t jump() { return jumpImm(BPF_JA, 0, 0); }
+
+    // Points the jump at the next instruction emitted.
+    void bind(size_t jump) { insns[jump].off = (int16_t)(insns.size() - jump - 1); }
+
+    // Loads the program; returns its fd, or -1 with errno set.
+    int load(bpf_prog_type type) const {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = type;
+        attr.insn_cnt = (uint32_t)insns.size();
+        attr.insns = (uint64_t)(uintptr_t)insns.data();
+        attr.license = (uint64_t)(uintptr_t)"GPL";
+        return (int)syscall(SYS_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+    }
+
+private:
+    void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+        struct bpf_insn insn = {};
+        insn.code = code;
+        insn.dst_reg = dst;
+        insn.src_reg = src;
+        insn.off = off;
+        insn.imm = imm;
+        insns.push_back(insn);
+    }
+
+    std::vector<struct bpf_insn> insns;
+};
+
+// Exact CPU accounting from the scheduler instead of /proc polling. A
+// program on the sched_switch raw tracepoint adds each slice a task was on
+// the CPU to a per-process total in a BPF hash map, and one on
+// sched_process_exit marks processes as gone, so those that lived less than a
+// tick still show up once with the time they used. Each tick reads the map
+// in a few batched syscalls; only the processes that make the cut (those
+// that have run, match the name filter, and are in the top-K by CPU when a
+// limit is set) have their stat read for RSS and start time. The filter is
+// applied here rather than in the program: a thread's comm can differ from
+// its process's, and time is charged to the whole process.
+class BpfSampler : public ProcScanner {
+public:
+    explicit BpfSampler(const SampleOptions &opts) : ProcScanner(opts) {
+        std::string error;
+        matcher.compile(opts.filter, error);  // a bad regex filters nothing here
+    }
+
+    ~BpfSampler() override {
+        for (int fd : {switchLink, exitLink, switchProg, exitProg, runtimeMap, startMap})
+            if (fd >= 0) close(fd);
+    }
+
+    const char *name() const override { return "bpf"; }
+
+    // Creates the maps and attaches both programs; false (with errno set)
+    // without CAP_BPF/CAP_SYS_ADMIN or on kernels older than 5.5 or so.
+    bool open() {
+        runtimeMap = createMap(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(Usage), kMaxProcesses);
+        startMap = createMap(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t), sizeof(uint64_t), 1);
+        if (runtimeMap < 0 || startMap < 0) return false;
+        switchProg = buildSwitchProgram().load(BPF_PROG_TYPE_RAW_TRACEPOINT);
+        exitProg = buildExitProgram().load(BPF_PROG_TYPE_RAW_TRACEPOINT);
+        if (switchProg < 0 || exitProg < 0) return false;
+        switchLink = attach("sched_switch", switchProg);
+        exitLink = attach("sched_process_exit", exitProg);
+        return switchLink >= 0 && exitLink >= 0;
+    }
+
+    bool sample(ProcessTable &procs) override {
+        if (!beginTick()) return false;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);  // bpf_ktime_get_ns's clock
+        uint64_t nowNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        double capacityNs = prevNs ? (double)(nowNs - prevNs) * get_nprocs() : 0;
+        prevNs = nowNs;
+
+        if (!readMap()) return false;
+        for (Ran &ran : seen) {
+            Tracked &entry = tracked[ran.tgid];
+            uint64_t used = ran.runtimeNs >= entry.runtimeNs ? ran.runtimeNs - entry.runtimeNs : ran.runtimeNs;
+            entry.runtimeNs = ran.runtimeNs;
+            entry.cpu = capacityNs > 0 ? used / capacityNs * 100.0 : 0.0;
+            ran.usedNs = used;
+        }
+
+        // A process that exited without its leader's exit event (the leader
+        // went first, or ran again after the mark) would linger; sweep for
+        // those now and then.
+        if (++sweepTicks == 64) {
+            sweepTicks = 0;
+            seen.erase(std::remove_if(seen.begin(), seen.end(), [&](const Ran &ran) {
+                bool gone = !ran.exited && ran.usedNs == 0 && kill((int)ran.tgid, 0) != 0 && errno == ESRCH;
+                if (gone) forget(ran.tgid);
+                return gone;
+            }), seen.end());
+        }
+
+        if (!matcher.matchesAll()) {
+            seen.erase(std::remove_if(seen.begin(), seen.end(), [&](const Ran &ran) { return !nameMatches(ran); }),
+                       seen.end());
+        }
+        if (options.topK && seen.size() > options.topK) {
+            std::nth_element(seen.begin(), seen.begin() + options.topK, seen.end(),
+                             [](const Ran &a, const Ran &b) { return a.usedNs > b.usedNs; });
+            seen.resize(options.topK);
+        }
+
+        clearPids();
+        for (const Ran &ran : seen) {
+            if (!ran.exited) addPid((int)ran.tgid);
+        }
+        scanPids(procs);
+
+        // CPU comes from the map, not stat's jiffies. A row also changed if
+        // its CPU did, even when stat looked the same at tick granularity.
+        for (size_t row = 0; row < procs.size(); ++row) {
+            Tracked &entry = tracked[procs.pid[row]];
+            if (entry.cpu != entry.shownCpu) procs.changed[row] = true;
+            procs.cpu[row] = entry.shownCpu = entry.cpu;
+        }
+
+        // Exited processes: one final row with the time they used, then forget them
+        for (const Ran &ran : seen) {
+            if (!ran.exited) continue;
+            uint32_t nameId = names.intern(ran.comm, strnlen(ran.comm, sizeof(ran.comm)));
+            procs.push((int)ran.tgid, tracked[ran.tgid].cpu, 0, 0, 0, nameId);
+            forget(ran.tgid);
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t kMaxProcesses = 1 << 16;
+    static const uint32_t kBatch = 4096;
+
+    // A runtime map value; the layout is shared with the programs.
+    struct Usage {
+        uint64_t runtimeNs;  // total on-CPU time of the process's threads
+        uint32_t exited;     // set by the sched_process_exit program
+        uint32_t pad;
+        char comm[16];  // of the thread that first ran; the leader's once exited
+    };
+
+    // One map entry as read this tick.
+    struct Ran {
+        uint32_t tgid;
+        bool exited;
+        char comm[16];
+        uint64_t runtimeNs, usedNs;
+    };
+
+    struct Tracked {
+        uint64_t runtimeNs = 0;  // map total at the last tick
+        double cpu = 0, shownCpu = 0;
+        int8_t matches = -1;  // name filter result: -1 untested, else 0/1
+    };
+
+    // Tests the filter once per process against its leader's comm, from
+    // /proc, or from the map if the process has already gone.
+    bool nameMatches(const Ran &ran) {
+        Tracked &entry = tracked[ran.tgid];
+        if (entry.matches >= 0) return entry.matches;
+        char path[32], comm[32];
+        snprintf(path, sizeof(path), "/proc/%u/comm", ran.tgid);
+        ssize_t len = -1;
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            len = read(fd, comm, sizeof(comm));
+            close(fd);
+        }
+        countSyscalls(3, len > 0 ? len : 0);
+        std::string name;
+        if (len > 0) name.assign(comm, comm[len - 1] == '\n' ? len - 1 : len);
+        else name.assign(ran.comm, strnlen(ran.comm, sizeof(ran.comm)));
+        entry.matches = matcher.matches(name);
+        return entry.matches;
+    }
+
+    static int createMap(bpf_map_type type, uint32_t keySize, uint32_t valueSize, uint32_t maxEntries) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_type = type;
+        attr.key_size = keySize;
+        attr.value_size = valueSize;
+        attr.max_entries = maxEntries;
+        return (int)syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+    }
+
+    static int attach(const char *tracepoint, int prog) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.raw_tracepoint.name = (uint64_t)(uintptr_t)tracepoint;
+        attr.raw_tracepoint.prog_fd = prog;
+        return (int)syscall(SYS_bpf, BPF_RAW_TRACEPOINT_OPEN, &attr, sizeof(attr));
+    }
+
+    // sched_switch runs with current == the task leaving the CPU. Charges it
+    // for the time since the last switch on this CPU, kept in startMap.
+    BpfAssembler buildSwitchProgram() const {
+        BpfAssembler bpf;
+        std::vector<size_t> done;
+        bpf.call(BPF_FUNC_ktime_get_ns);
+        bpf.movReg(BPF_REG_7, BPF_REG_0);
+        bpf.storeImm(BPF_W, BPF_REG_10, -4, 0);
+        bpf.loadMap(BPF_REG_1, startMap);
+        bpf.movReg(BPF_REG_2, BPF_REG_10);
+        bpf.aluImm(BPF_ADD, BPF_REG_2, -4);
+        bpf.call(BPF_FUNC_map_lookup_elem);
+        done.push_back(bpf.jumpImm(BPF_JEQ, BPF_REG_0, 0));
+        bpf.load(BPF_DW, BPF_REG_1, BPF_REG_0, 0);
+        bpf.store(BPF_DW, BPF_REG_0, 0, BPF_REG_7);
+        done.push_back(bpf.jumpImm(BPF_JEQ, BPF_REG_1, 0));  // first switch seen on this CPU
+        bpf.aluReg(BPF_SUB, BPF_REG_7, BPF_REG_1);
+
+        // The idle task is pid 0; key everything else by tgid at fp-4
+        bpf.call(BPF_FUNC_get_current_pid_tgid);
+        bpf.mov32Reg(BPF_REG_1, BPF_REG_0);
+        done.push_back(bpf.jumpImm(BPF_JEQ, BPF_REG_1, 0));
+        bpf.aluImm(BPF_RSH, BPF_REG_0, 32);
+        bpf.store(BPF_W, BPF_REG_10, -4, BPF_REG_0);
+
+        auto lookupAndAdd = [&] {
+            bpf.loadMap(BPF_REG_1, runtimeMap);
+            bpf.movReg(BPF_REG_2, BPF_REG_10);
+            bpf.aluImm(BPF_ADD, BPF_REG_2, -4);
+            bpf.call(BPF_FUNC_map_lookup_elem);
+            size_t missing = bpf.jumpImm(BPF_JEQ, BPF_REG_0, 0);
+            bpf.atomicAdd(BPF_REG_0, 0, BPF_REG_7);
+            done.push_back(bpf.jump());
+            bpf.bind(missing);
+        };
+        lookupAndAdd();
+
+        // New process: insert a Usage built at fp-40 (comm at fp-24)
+        bpf.store(BPF_DW, BPF_REG_10, -40, BPF_REG_7);
+        bpf.storeImm(BPF_DW, BPF_REG_10, -32, 0);
+        bpf.movReg(BPF_REG_1, BPF_REG_10);
+        bpf.aluImm(BPF_ADD, BPF_REG_1, -24);
+        bpf.movImm(BPF_REG_2, 16);
+        bpf.call(BPF_FUNC_get_current_comm);
+        bpf.loadMap(BPF_REG_1, runtimeMap);
+        bpf.movReg(BPF_REG_2, BPF_REG_10);
+        bpf.aluImm(BPF_ADD, BPF_REG_2, -4);
+        bpf.movReg(BPF_REG_3, BPF_REG_10);
+        bpf.aluImm(BPF_ADD, BPF_REG_3, -40);
+        bpf.movImm(BPF_REG_4, BPF_NOEXIST);
+        bpf.call(BPF_FUNC_map_update_elem);
+        done.push_back(bpf.jumpImm(BPF_JEQ, BPF_REG_0, 0));
+        lookupAndAdd();  // another CPU inserted it first
+
+        for (size_t jump : done) bpf.bind(jump);
+        bpf.movImm(BPF_REG_0, 0);
+        bpf.exit();
+        return bpf;
+    }
+
+    // sched_process_exit runs as the exiting thread; only the group leader
+    // leaving means the process is gone. Its comm replaces whichever
+    // thread's was stored, for the final row.
+    BpfAssembler buildExitProgram() const {
+        BpfAssembler bpf;
+        std::vector<size_t> done;
+        bpf.call(BPF_FUNC_get_current_pid_tgid);
+        bpf.mov32Reg(BPF_REG_1, BPF_REG_0);
+        bpf.aluImm(BPF_RSH, BPF_REG_0, 32);
+        done.push_back(bpf.jumpReg(BPF_JNE, BPF_REG_1, BPF_REG_0));
+        bpf.store(BPF_W, BPF_REG_10, -4, BPF_REG_0);
+        bpf.loadMap(BPF_REG_1, runtimeMap);
+        bpf.movReg(BPF_REG_2, BPF_REG_10);
+        bpf.aluImm(BPF_ADD, BPF_REG_2, -4);
+        bpf.call(BPF_FUNC_map_lookup_elem);
+        done.push_back(bpf.jumpImm(BPF_JEQ, BPF_REG_0, 0));
+        bpf.storeImm(BPF_W, BPF_REG_0, offsetof(Usage, exited), 1);
+        bpf.movReg(BPF_REG_1, BPF_REG_0);
+        bpf.aluImm(BPF_ADD, BPF_REG_1, offsetof(Usage, comm));
+        bpf.movImm(BPF_REG_2, 16);
+        bpf.call(BPF_FUNC_get_current_comm);
+        for (size_t jump : done) bpf.bind(jump);
+        bpf.movImm(BPF_REG_0, 0);
+        bpf.exit();
+        return bpf;
+    }
+
+    // Copies the whole runtime map into seen, kBatch entries per syscall
+    // (one key at a time on kernels without batch lookups).
+    bool readMap() {
+        seen.clear();
+        keys.resize(kBatch);
+        values.resize(kBatch);
+        auto add = [&](uint32_t key, const Usage &value) {
+            Ran entry;
+            entry.tgid = key;
+            entry.exited = value.exited != 0;
+            memcpy(entry.comm, value.comm, sizeof(entry.comm));
+            entry.runtimeNs = value.runtimeNs;
+            entry.usedNs = 0;
+            seen.push_back(entry);
+        };
+
+        uint64_t token = 0;
+        bool first = true;
+        while (batchLookups) {
+            union bpf_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.batch.in_batch = first ? 0 : (uint64_t)(uintptr_t)&token;
+            attr.batch.out_batch = (uint64_t)(uintptr_t)&token;
+            attr.batch.keys = (uint64_t)(uintptr_t)keys.data();
+            attr.batch.values = (uint64_t)(uintptr_t)values.data();
+            attr.batch.count = kBatch;
+            attr.batch.map_fd = runtimeMap;
+            long result = syscall(SYS_bpf, BPF_MAP_LOOKUP_BATCH, &attr, sizeof(attr));
+            countSyscalls(1, attr.batch.count * sizeof(Usage));
+            if (result != 0 && errno != ENOENT) {
+                if (!first || (errno != EINVAL && errno != ENOTSUP && errno != ENOSYS)) return false;
+                batchLookups = false;  // older kernel: fall back below
+                break;
+            }
+            for (uint32_t i = 0; i < attr.batch.count; ++i) add(keys[i], values[i]);
+            if (result != 0) return true;  // ENOENT: that was the last batch
+            first = false;
+        }
+
+        uint32_t key, nextKey;
+        for (void *prev = nullptr;; prev = &key) {
+            union bpf_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.map_fd = runtimeMap;
+            attr.key = (uint64_t)(uintptr_t)prev;
+            attr.next_key = (uint64_t)(uintptr_t)&nextKey;
+            countSyscalls(1);
+            if (syscall(SYS_bpf, BPF_MAP_GET_NEXT_KEY, &attr, sizeof(attr)) != 0) return errno == ENOENT;
+            key = nextKey;
+            attr.key = (uint64_t)(uintptr_t)&key;
+            attr.value = (uint64_t)(uintptr_t)values.data();
+            bool found = syscall(SYS_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr)) == 0;
+            countSyscalls(1, found ? sizeof(Usage) : 0);
+            if (found) add(key, values[0]);
+        }
+    }
+
+    void forget(uint32_t tgid) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = runtimeMap;
+        attr.key = (uint64_t)(uintptr_t)&tgid;
+        syscall(SYS_bpf, BPF_MAP_DELETE_ELEM, &attr, sizeof(attr));
+        countSyscalls(1);
+        tracked.erase(tgid);
+    }
+
+    int runtimeMap = -1, startMap = -1;
+    int switchProg = -1, exitProg = -1;
+    int switchLink = -1, exitLink = -1;
+    bool batchLookups = true;
+    NameMatcher matcher;
+    uint64_t prevNs = 0;
+    unsigned sweepTicks = 0;
+    std::vector<uint32_t> keys;
+    std::vector<Usage> values;
+    std::vector<Ran> seen;  // the map as of this tick
+    std::pmr::unsynchronized_pool_resource trackedNodes;
+    std::pmr::unordered_map<uint32_t, Tracked> tracked{&trackedNodes};
+};
+
+// Builds the backend named by options.backend, falling back to /proc
+// polling when the requested one can't be used here.
+std::unique_ptr<SamplerBackend> makeSampler(const SampleOptions &options) {
+    if (options.backend == "netlink") {
+        auto sampler = std::make_unique<NetlinkSampler>(options);
+        if (sampler->open()) return sampler;
+        std::cerr << "netlink sampler unavailable (" << strerror(errno) << "), using /proc polling\n";
+    } else if (options.backend == "io_uring") {
+        auto sampler = std::make_unique<IoUringScanner>(options);
+        if (sampler->open()) return sampler;
+        std::cerr << "io_uring sampler unavailable (" << strerror(errno) << "), using synchronous reads\n";
+    } else if (options.backend == "bpf") {
+        auto sampler = std::make_unique<BpfSampler>(options);
+        if (sampler->open()) return sampler;
+        std::cerr << "bpf sampler unavailable (" << strerror(errno) << "), using /proc polling\n";
+    }
+    return std::make_unique<ProcScanner>(options);
+}
+
+bool getProcessList(ProcessTable &procs, SamplerBackend &sampler) {
+    ProfileScope scope(Stage::Scan);
+    if (!sampler.sample(procs)) return false;
+    procs.tick = ++sampler.ticks;
+    procs.selectAll();
+    return true;
+}
+
+// One ThreadSampler::sample(): every expanded process's threads in one table.
+struct ThreadRows {
+    ProcessTable table;
+    std::unordered_map<int, std::vector<unsigned>> rowsByPid;
+
+    // Thread rows of pid, busiest first, or nullptr if it isn't expanded.
+    const std::vector<unsigned> *threadsOf(int pid) const {
+        auto it = rowsByPid.find(pid);
+        return it == rowsByPid.end() ? nullptr : &it->second;
+    }
+};
+
+// Per-thread drill-down for the processes the user expanded. Only those
+// processes' /proc/<pid>/task directories are listed, and each thread goes
+// through the same CpuHistory and FdCache machinery as the process scan,
+// keyed by tid, so nothing is paid for threads nobody is looking at.
+class ThreadSampler {
+public:
+    ThreadSampler() {
+        shard.names = &names;
+        shard.procs.names = &names;
+        shard.fds.maxFds = 256;  // keeps a few busy processes' threads open without eating the scan's budget
+    }
+
+    bool isExpanded(int pid) const { return expanded.count(pid) != 0; }
+
+    // Expands pid, or collapses it if already expanded. Returns the new state.
+    bool toggle(int pid) {
+        if (expanded.erase(pid)) return false;
+        expanded.insert(pid);
+        return true;
+    }
+
+    // Re-reads the threads of every expanded process into out. Processes
+    // that have exited are collapsed.
+    void sample(ThreadRows &out) {
+        out.rowsByPid.clear();
+        out.table.clear();
+        if (expanded.empty()) return;
+
+        unsigned long long totalJiffies;
+        if (!readTotalJiffies(totalJiffies)) return;
+        unsigned long long elapsedJiffies = prevTotalJiffies ? totalJiffies - prevTotalJiffies : 0;
+        prevTotalJiffies = totalJiffies;
+
+        SampleOptions options;  // threads share their process's memory, so status adds nothing
+        beginShard(shard);
+        char path[128], file[48], statBuf[1024];
+        for (auto it = expanded.begin(); it != expanded.end();) {
+            int pid = *it;
+            snprintf(path, sizeof(path), "%s/%d/task", procRoot, pid);
+            DIR *taskDir = opendir(path);
+            if (!taskDir) {
+                it = expanded.erase(it);
+                continue;
+            }
+
+            size_t first = shard.procs.size();
+            while (struct dirent *entry = readdir(taskDir)) {
+                int tid = parsePid(entry->d_name);
+                if (tid <= 0) continue;
+                snprintf(file, sizeof(file), "task/%d/stat", tid);
+                FdCache::Entry &cached = shard.fds.lookup(tid);
+                ssize_t len = shard.fds.read(cached.statFd, pid, file, statBuf, sizeof(statBuf));
+                recordProcess(shard, options, elapsedJiffies, tid, cached, statBuf, len);
+            }
+            closedir(taskDir);
+
+            std::vector<unsigned> &rows = out.rowsByPid[pid];
+            for (size_t row = first; row < shard.procs.size(); ++row) rows.push_back((unsigned)row);
+            std::sort(rows.begin(), rows.end(), [&](unsigned a, unsigned b) {
+                const ProcessTable &t = shard.procs;
+                return t.cpu[a] != t.cpu[b] ? t.cpu[a] > t.cpu[b] : t.pid[a] < t.pid[b];
+            });
+            ++it;
+        }
+        endShard(shard);
+        out.table = shard.procs;
+    }
+
+private:
+    NamePool names;
+    SampleShard shard;
+    std::unordered_set<int> expanded;
+    unsigned long long prevTotalJiffies = 0;
+};
+
+// Where the cgroup v2 hierarchy is mounted: /sys/fs/cgroup on unified
+// hosts, /sys/fs/cgroup/unified on hybrid ones. Empty if there is none.
+std::string findCgroup2Mount() {
+    char buf[16384];
+    if (readProcFile("/proc/self/mounts", buf, sizeof(buf)) <= 0) return "";
+    for (const char *line = buf; *line;) {
+        const char *eol = strchr(line, '\n');
+        if (!eol) eol = line + strlen(line);
+        char device[64], mountPoint[256], type[32];
+        std::string entry(line, eol);
+        if (sscanf(entry.c_str(), "%63s %255s %31s", device, mountPoint, type) == 3 && strcmp(type, "cgroup2") == 0)
+            return mountPoint;
+        line = *eol ? eol + 1 : eol;
+    }
+    return "";
+}
+
+// Groups processes by cgroup v2 path. A process's cgroup is read once per
+// pid+starttime and cached; every tick the selected rows are summed into
+// their cgroup and all its ancestors, and each active cgroup's own
+// cpu.stat and memory.current are read through descriptors kept open.
+// The result is a ProcessTable with one row per cgroup, so ranking and
+// printProcessList work on it unchanged: pid holds the process count and
+// the name is the cgroup path.
+class CgroupView {
+public:
+    CgroupView() : mount(findCgroup2Mount()), cpus(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN))) {
+        groups.names = &paths;
+    }
+    CgroupView(const CgroupView &) = delete;
+    CgroupView &operator=(const CgroupView &) = delete;
+    ~CgroupView() {
+        for (Node &node : nodes) closeNode(node);
+    }
+
+    bool available() const { return !mount.empty(); }
+
+    void update(const ProcessTable &procs) {
+        ++generation;
+        auto now = std::chrono::steady_clock::now();
+        for (Node &node : nodes) {
+            node.tasks = 0;
+            node.cpuSum = 0;
+            node.rssSum = node.swapSum = 0;
+        }
+
+        for (size_t row = 0; row < procs.size(); ++row) {
+            if (!procs.selected(row)) continue;
+            ProcessKey key = {procs.pid[row], procs.startTime[row]};
+            auto it = byProcess.find(key);
+            if (it == byProcess.end()) it = byProcess.emplace(key, CachedGroup{lookupGroup(key.pid), 0}).first;
+            it->second.generation = generation;
+            for (uint32_t id = it->second.id; id != NamePool::kNone; id = nodes[id].parent) {
+                Node &node = nodes[id];
+                ++node.tasks;
+                node.cpuSum += procs.cpu[row];
+                node.rssSum += procs.rssKb[row];
+                node.swapSum += procs.swapKb[row];
+            }
+        }
+        for (auto it = byProcess.begin(); it != byProcess.end();) {
+            if (it->second.generation != generation) it = byProcess.erase(it);
+            else ++it;
+        }
+
+        groups.clear();
+        for (uint32_t id = 0; id < nodes.size(); ++id) {
+            Node &node = nodes[id];
+            if (!node.tasks) {
+                closeNode(node);  // idle cgroups hold no descriptors
+                continue;
+            }
+            double cpu = node.cpuSum;
+            uint64_t rssKb = node.rssSum;
+            unsigned long long usageUsec;
+            if (readCpuUsage(node, id, usageUsec)) {
+                if (node.prevUsageUsec && usageUsec >= node.prevUsageUsec) {
+                    double wallUsec = std::chrono::duration<double, std::micro>(now - node.prevTime).count();
+                    cpu = wallUsec > 0 ? (usageUsec - node.prevUsageUsec) / (wallUsec * cpus) * 100.0 : 0.0;
+                }
+                node.prevUsageUsec = usageUsec;
+                node.prevTime = now;
+            }
+            unsigned long long memoryBytes;
+            if (readMemoryCurrent(node, id, memoryBytes)) rssKb = memoryBytes / 1024;
+            groups.push((int)node.tasks, cpu, rssKb, node.swapSum, 0, id);
+        }
+        groups.selectAll();
+    }
+
+    const ProcessTable &table() const { return groups; }
+
+private:
+    struct Node {
+        uint32_t parent = NamePool::kNone;
+        unsigned tasks = 0;
+        double cpuSum = 0;
+        uint64_t rssSum = 0, swapSum = 0;
+        int cpuFd = -1, memoryFd = -1;
+        bool noMemoryFile = false;  // the memory controller isn't enabled here
+        unsigned long long prevUsageUsec = 0;
+        std::chrono::steady_clock::time_point prevTime;
+    };
+
+    struct CachedGroup {
+        uint32_t id;
+        unsigned long generation;
+    };
+
+    // Returns the node for path, creating it and its ancestors as needed.
+    uint32_t intern(const std::string &path) {
+        uint32_t id = paths.intern(path.data(), path.size());
+        if (id < nodes.size()) return id;
+        nodes.resize(id + 1);
+        if (path != "/") {
+            size_t slash = path.rfind('/');
+            uint32_t parent = intern(slash == 0 ? "/" : path.substr(0, slash));
+            nodes[id].parent = parent;
+        }
+        return id;
+    }
+
+    uint32_t lookupGroup(int pid) {
+        char path[128], buf[4096];
+        snprintf(path, sizeof(path), "%s/%d/cgroup", procRoot, pid);
+        if (readProcFile(path, buf, sizeof(buf)) > 0) {
+            // The v2 entry is "0::/path"; v1 hierarchies have their own lines
+            for (const char *line = buf; *line;) {
+                const char *eol = strchr(line, '\n');
+                if (!eol) eol = line + strlen(line);
+                if (strncmp(line, "0::", 3) == 0 && line[3] == '/') return intern(std::string(line + 3, eol));
+                line = *eol ? eol + 1 : eol;
+            }
+        }
+        return intern("/");
+    }
+
+    // Opens <mount><cgroup path>/<file> into fd on first use, then preads it.
+    ssize_t readCgroupFile(int &fd, uint32_t id, const char *file, char *buf, size_t size) {
+        if (fd < 0) {
+            const std::string &group = paths.name(id);
+            std::string path = mount + (group == "/" ? "" : group) + "/" + file;
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            countSyscalls(1);
+            if (fd < 0) return -1;
+        }
+        ssize_t len = pread(fd, buf, size - 1, 0);
+        countSyscalls(1, len);
+        if (len < 0) {
+            close(fd);
+            fd = -1;
+            return -1;
+        }
+        buf[len] = '\0';
+        return len;
+    }
+
+    bool readCpuUsage(Node &node, uint32_t id, unsigned long long &usageUsec) {
+        char buf[1024];
+        if (mount.empty() || readCgroupFile(node.cpuFd, id, "cpu.stat", buf, sizeof(buf)) <= 0) return false;
+        const char *p = strstr(buf, "usage_usec ");
+        if (!p) return false;
+        p += 11;
+        usageUsec = scanNumber(p);
+        return true;
+    }
+
+    bool readMemoryCurrent(Node &node, uint32_t id, unsigned long long &bytes) {
+        char buf[64];
+        if (mount.empty() || node.noMemoryFile) return false;
+        if (readCgroupFile(node.memoryFd, id, "memory.current", buf, sizeof(buf)) <= 0) {
+            node.noMemoryFile = errno == ENOENT;  // the root cgroup never has one
+            return false;
+        }
+        const char *p = buf;
+        bytes = scanNumber(p);
+        return true;
+    }
+
+    void closeNode(Node &node) {
+        for (int *fd : {&node.cpuFd, &node.memoryFd}) {
+            if (*fd >= 0) close(*fd);
+            *fd = -1;
+        }
+        node.prevUsageUsec = 0;
+        node.noMemoryFile = false;
+    }
+
+    std::string mount;
+    long cpus;
+    NamePool paths;
+    std::vector<Node> nodes;  // indexed by path id in paths
+    std::unordered_map<ProcessKey, CachedGroup, ProcessKeyHash> byProcess;
+    unsigned long generation = 0;
+    ProcessTable groups;
+};
+
+// Columns the process list can be ordered by; 's' cycles through them.
+enum class SortKey { Cpu, Ram, Io, Count };
+
+const char *sortKeyName(SortKey key) {
+    switch (key) {
+    case SortKey::Cpu: return "CPU";
+    case SortKey::Ram: return "RAM";
+    case SortKey::Io: return "DISK I/O";
+    default: return "?";
+    }
+}
+
+double sortValue(const ProcessTable &procs, size_t row, SortKey key) {
+    switch (key) {
+    case SortKey::Cpu: return procs.cpu[row];
+    case SortKey::Ram: return (double)procs.rssKb[row];
+    case SortKey::Io: return (double)(procs.io[row].readBps + procs.io[row].writeBps);
+    default: return 0.0;
+    }
+}
+
+// A process's position in the ranking, with its sort key evaluated once per tick.
+struct RankedRow {
+    double key;
     int pid;
-    std::string name;
-    double cpuUsage;
-    double ramUsage;
-};
-
-bool getProcessList(std::vector<ProcessInfo> &procs) {
-    procs.clear();
-    std::ifstream procStat("/proc/stat");
-    if (!procStat.is_open()) return false;
-
-    std::string cpuLine;
-    std::getline(procStat, cpuLine);
-    std::istringstream cpuStream(cpuLine);
-
-    std::string cpu;
-    long totalJiffies = 0;
-    long user, nice, system, idle;
-    cpuStream >> cpu >> user >> nice >> system >> idle;
-    totalJiffies = user + nice + system + idle;
-
-    for (int pid = 1; pid < 32768; pid++) {
-        std::string statPath = "/proc/" + std::to_string(pid) + "/stat";
-        std::ifstream statFile(statPath);
-        if (!statFile.is_open()) continue;
-
-        std::string comm;
-        char state;
-        long utime, stime;
-        statFile >> pid >> comm >> state >> std::ws;
-        for (int i = 0; i < 11; ++i) statFile >> std::ws;  // Skip to utime field
-        statFile >> utime >> stime;
-
-        double cpuUsage = (double)(utime + stime) / totalJiffies * 100.0;
-
-        std::string statusPath = "/proc/" + std::to_string(pid) + "/status";
-        std::ifstream statusFile(statusPath);
-        if (!statusFile.is_open()) continue;
-
-        std::string line;
-        long ramUsage = 0;
-        while (std::getline(statusFile, line)) {
-            if (line.rfind("VmRSS:", 0) == 0) {
-                std::istringstream ramStream(line);
-                std::string key;
-                ramStream >> key >> ramUsage;
+    unsigned index;  // row in the process table
+};
+
+// Fills rows with the k highest-ranked processes in display order (key
+// descending, then pid). Only those k get fully sorted: nth_element
+// partitions them out first, so a tick costs O(n + k log k) instead of O(n log n).
+void rankTopK(const ProcessTable &procs, SortKey key, size_t k, std::vector<RankedRow> &rows) {
+    ProfileScope scope(Stage::Sort);
+    rows.clear();
+    rows.reserve(procs.size());
+    for (unsigned i = 0; i < procs.size(); ++i) {
+        if (procs.selected(i)) rows.push_back({sortValue(procs, i, key), procs.pid[i], i});
+    }
+
+    auto before = [](const RankedRow &a, const RankedRow &b) {
+        return a.key != b.key ? a.key > b.key : a.pid < b.pid;
+    };
+    if (k < rows.size()) {
+        std::nth_element(rows.begin(), rows.begin() + k, rows.end(), before);
+        rows.resize(k);
+    }
+    std::sort(rows.begin(), rows.end(), before);
+}
+
+// Double-buffered terminal frame. present() compares the new frame to the one
+// already on screen and sends only cursor moves plus the runs of cells that
+// changed, all in a single write().
+class Screen {
+public:
+    // Starts a new frame sized to the current terminal.
+    void beginFrame() {
+        struct winsize ws;
+        int newRows = 24, newCols = 80;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            newRows = ws.ws_row;
+            newCols = ws.ws_col;
+        }
+        if (newRows != height || newCols != width) {
+            height = newRows;
+            width = newCols;
+            invalidate();
+        }
+        next.resize(height);
+        nextTags.assign(height, 0);
+        reused.assign(height, false);
+        used = 0;
+    }
+
+    int rows() const { return height; }
+    int columns() const { return width; }
+
+    // Appends a line, clipped to the terminal width. Lines past the bottom
+    // are dropped. A nonzero tag lets the next frame reuse the line.
+    void addLine(const char *text, size_t len, uint64_t tag = 0) {
+        if (used >= (size_t)height) return;
+        nextTags[used] = tag;
+        std::string &line = next[used++];
+        line.assign(width, ' ');
+        for (size_t i = 0; i < len && i < (size_t)width; ++i) {
+            unsigned char ch = text[i];
+            line[i] = (ch >= 0x20 && ch < 0x7f) ? ch : '?';
+        }
+    }
+
+    void addLine(const std::string &text) { addLine(text.data(), text.size()); }
+
+    // Repeats the previous frame's line at this position if it carried tag,
+    // skipping both formatting and the diff for it. Returns whether it did.
+    bool reuseLine(uint64_t tag) {
+        if (!tag || used >= (size_t)height || prev.size() != next.size() || prevTags[used] != tag) return false;
+        next[used] = prev[used];
+        nextTags[used] = tag;
+        reused[used++] = true;
+        return true;
+    }
+
+    // Forces the next present() to repaint everything, e.g. after other output.
+    void invalidate() {
+        prev.clear();
+        prevTags.clear();
+    }
+
+    void present() {
+        for (size_t r = used; r < next.size(); ++r) next[r].assign(width, ' ');
+
+        out.clear();
+        bool repaint = prev.size() != next.size();
+        if (repaint) out += "\033[H\033[2J";
+
+        char move[32];
+        for (int r = 0; r < height; ++r) {
+            const std::string &line = next[r];
+            if (reused[r] && !repaint) continue;
+            if (repaint) {
+                size_t last = line.find_last_not_of(' ');
+                if (last == std::string::npos) continue;  // already blank after the clear
+                snprintf(move, sizeof(move), "\033[%d;1H", r + 1);
+                out += move;
+                out.append(line, 0, last + 1);
+                continue;
+            }
+
+            int c = 0;
+            while (c < width) {
+                if (line[c] == prev[r][c]) {
+                    ++c;
+                    continue;
+                }
+                // Extend the run over short unchanged gaps; rewriting a few
+                // cells is cheaper than another cursor move.
+                int end = c + 1, lastChanged = c;
+                while (end < width && end - lastChanged <= 4) {
+                    if (line[end] != prev[r][end]) lastChanged = end;
+                    ++end;
+                }
+                snprintf(move, sizeof(move), "\033[%d;%dH", r + 1, c + 1);
+                out += move;
+                out.append(line, c, lastChanged - c + 1);
+                c = lastChanged + 1;
+            }
+        }
+        snprintf(move, sizeof(move), "\033[%d;1H", height);
+        out += move;
+
+        std::cout.flush();
+        for (size_t done = 0; done < out.size();) {
+            ssize_t n = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        prev.swap(next);
+        prevTags.swap(nextTags);
+    }
+
+private:
+    int height = 0, width = 0;
+    std::vector<std::string> prev, next;
+    std::vector<uint64_t> prevTags, nextTags;  // 0 for lines that can't be reused
+    std::vector<uint8_t> reused;  // lines of next copied from prev this frame
+    size_t used = 0;  // lines added to next this frame
+    std::string out;
+};
+
+// What the summary panel shows, as of the last HostSummary::update().
+// Plain values, so a copy can travel with a snapshot to the UI thread.
+struct HostStats {
+    // Share of one CPU (or of all, for the aggregate) over the last interval, in %.
+    struct Cpu {
+        double busy = 0, user = 0, system = 0, iowait = 0, irq = 0, steal = 0;
+    };
+
+    struct Pressure {
+        bool present = false;
+        double some10 = 0, full10 = 0;  // avg10 of the "some" and "full" lines
+    };
+
+    // Adds the panel's lines to screen and returns how many it used.
+    int render(Screen &screen) const {
+        char line[512];
+        int lines = 0;
+        const double gib = 1024.0 * 1024.0;
+        int len = snprintf(line, sizeof(line),
+                           "load %.2f %.2f %.2f | tasks %llu/%llu | cpu %5.1f%% (usr %.1f sys %.1f irq %.1f "
+                           "iowait %.1f steal %.1f)",
+                           load[0], load[1], load[2], runnable, tasks, all.busy, all.user, all.system, all.irq,
+                           all.iowait, all.steal);
+        screen.addLine(line, len);
+        ++lines;
+
+        len = snprintf(line, sizeof(line), "mem %.1f/%.1f GiB used, %.1f available, %.1f cache | swap %.1f/%.1f GiB",
+                       (memTotalKb - memAvailableKb) / gib, memTotalKb / gib, memAvailableKb / gib,
+                       (buffersKb + cachedKb) / gib, (swapTotalKb - swapFreeKb) / gib, swapTotalKb / gib);
+        if (cpuPressure.present || memoryPressure.present || ioPressure.present) {
+            len += snprintf(line + len, sizeof(line) - len, " | psi avg10 some/full: cpu %.2f mem %.2f/%.2f io %.2f/%.2f",
+                            cpuPressure.some10, memoryPressure.some10, memoryPressure.full10, ioPressure.some10,
+                            ioPressure.full10);
+        }
+        screen.addLine(line, len);
+        ++lines;
+
+        // Per-core meters, as many to a line as fit, on at most four lines
+        const int cellWidth = 24;  // "%3zu [%s] %5.1f%% "
+        int perLine = std::max(1, std::min(screen.columns(), (int)sizeof(line) - 1) / cellWidth);
+        for (size_t first = 0; first < cores.size() && lines < 6; first += perLine) {
+            len = 0;
+            for (size_t core = first; core < cores.size() && core < first + perLine; ++core) {
+                char bar[11];
+                int filled = std::min(10, (int)(cores[core].busy / 10 + 0.5));
+                memset(bar, '|', filled);
+                memset(bar + filled, ' ', 10 - filled);
+                bar[10] = '\0';
+                len += snprintf(line + len, sizeof(line) - len, "%3zu [%s] %5.1f%% ", core, bar, cores[core].busy);
+            }
+            screen.addLine(line, len);
+            ++lines;
+        }
+        return lines;
+    }
+
+    Cpu all;
+    std::vector<Cpu> cores;
+    unsigned long long memTotalKb = 0, memAvailableKb = 0, buffersKb = 0, cachedKb = 0, swapTotalKb = 0, swapFreeKb = 0;
+    double load[3] = {};
+    unsigned long long runnable = 0, tasks = 0;
+    Pressure cpuPressure, memoryPressure, ioPressure;
+};
+
+// Host-wide numbers for the summary panel: per-core CPU from every cpuN
+// line of /proc/stat, /proc/meminfo, /proc/loadavg and PSI. Each file is
+// opened once and re-read with pread into a buffer allocated up front, and
+// parsed in a single pass, so a refresh is a handful of syscalls.
+class HostSummary {
+public:
+    HostSummary() : buf(1 << 16) {
+        const char *files[] = {"stat", "meminfo", "loadavg", "pressure/cpu", "pressure/memory", "pressure/io"};
+        char path[128];
+        for (int i = 0; i < FileCount; ++i) {
+            snprintf(path, sizeof(path), "%s/%s", procRoot, files[i]);
+            fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+    HostSummary(const HostSummary &) = delete;
+    HostSummary &operator=(const HostSummary &) = delete;
+    ~HostSummary() {
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+    }
+
+    void update() {
+        if (read(Stat)) parseStat();
+        if (read(Meminfo)) parseMeminfo();
+        if (read(Loadavg)) {
+            char *end = buf.data();
+            for (double &value : current.load) value = strtod(end, &end);
+            const char *p = end;
+            current.runnable = scanNumber(p);
+            current.tasks = *p == '/' ? scanNumber(++p) : 0;
+        }
+        current.cpuPressure.present = read(PressureCpu) && parsePressure(current.cpuPressure);
+        current.memoryPressure.present = read(PressureMemory) && parsePressure(current.memoryPressure);
+        current.ioPressure.present = read(PressureIo) && parsePressure(current.ioPressure);
+    }
+
+    const HostStats &stats() const { return current; }
+    int render(Screen &screen) const { return current.render(screen); }
+
+private:
+    enum File { Stat, Meminfo, Loadavg, PressureCpu, PressureMemory, PressureIo, FileCount };
+
+    bool read(File file) {
+        if (fds[file] < 0) return false;
+        ssize_t len = pread(fds[file], buf.data(), buf.size() - 1, 0);
+        countSyscalls(1, len);
+        if (len <= 0) return false;
+        buf[len] = '\0';
+        return true;
+    }
+
+    // user nice system idle iowait irq softirq steal, cumulative jiffies
+    struct Counters {
+        unsigned long long field[8] = {};
+    };
+
+    static HostStats::Cpu delta(const Counters &now, const Counters &before) {
+        unsigned long long d[8], total = 0;
+        for (int i = 0; i < 8; ++i) {
+            d[i] = now.field[i] >= before.field[i] ? now.field[i] - before.field[i] : 0;
+            total += d[i];
+        }
+        HostStats::Cpu cpu;
+        if (!total) return cpu;
+        double scale = 100.0 / total;
+        cpu.user = (d[0] + d[1]) * scale;
+        cpu.system = d[2] * scale;
+        cpu.iowait = d[4] * scale;
+        cpu.irq = (d[5] + d[6]) * scale;
+        cpu.steal = d[7] * scale;
+        cpu.busy = (total - d[3] - d[4]) * scale;
+        return cpu;
+    }
+
+    // The cpu lines come first; parsing stops at the first other line.
+    void parseStat() {
+        const char *p = buf.data();
+        size_t core = 0;
+        while (strncmp(p, "cpu", 3) == 0) {
+            p += 3;
+            bool aggregate = *p == ' ';
+            if (!aggregate) scanNumber(p);  // the core number; lines are in order
+            Counters now;
+            for (auto &field : now.field) field = scanNumber(p);
+            if (aggregate) {
+                current.all = delta(now, prevAll);
+                prevAll = now;
+            } else {
+                if (core >= prevCores.size()) {  // first tick, or a CPU came online
+                    prevCores.resize(core + 1);
+                    current.cores.resize(core + 1);
+                }
+                current.cores[core] = delta(now, prevCores[core]);
+                prevCores[core] = now;
+                ++core;
+            }
+            p = strchr(p, '\n');
+            if (!p) break;
+            ++p;
+        }
+        if (core) current.cores.resize(core);
+    }
+
+    void parseMeminfo() {
+        struct Field {
+            const char *key;
+            size_t keyLen;
+            unsigned long long *value;
+        };
+        const Field fields[] = {
+            {"MemTotal:", 9, &current.memTotalKb}, {"MemAvailable:", 13, &current.memAvailableKb},
+            {"Buffers:", 8, &current.buffersKb},   {"Cached:", 7, &current.cachedKb},
+            {"SwapTotal:", 10, &current.swapTotalKb}, {"SwapFree:", 9, &current.swapFreeKb},
+        };
+        for (const char *p = buf.data(); *p;) {
+            for (const Field &field : fields) {
+                if (strncmp(p, field.key, field.keyLen) == 0) {
+                    p += field.keyLen;
+                    *field.value = scanNumber(p);
+                    break;
+                }
+            }
+            p = strchr(p, '\n');
+            if (!p) break;
+            ++p;
+        }
+    }
+
+    bool parsePressure(HostStats::Pressure &out) {
+        const char *some = strstr(buf.data(), "some avg10=");
+        if (!some) return false;
+        out.some10 = strtod(some + 11, nullptr);
+        const char *full = strstr(buf.data(), "full avg10=");
+        out.full10 = full ? strtod(full + 11, nullptr) : 0;
+        return true;
+    }
+
+    std::vector<char> buf;
+    int fds[FileCount];
+    HostStats current;
+    Counters prevAll;
+    std::vector<Counters> prevCores;
+};
+
+// Last N ticks of CPU% and RSS for every live process, for the sparkline
+// and rolling min/avg/max columns. Each process gets a slot in one slab of
+// fixed-size rings (10 bytes per tick per process), so nothing is allocated
+// per process and memory is bounded by slots x N. The average keeps a
+// running sum and min/max keep monotonic queues of ring positions, so a
+// tick costs O(1) amortized per process.
+class ProcessHistory {
+public:
+    explicit ProcessHistory(unsigned length) : length(std::max(2u, std::min(length, 4096u))) {}
+
+    unsigned window() const { return length; }
+
+    // Appends one tick for every row in procs and frees the slots of
+    // processes that are gone.
+    void update(const ProcessTable &procs) {
+        ++generation;
+        for (size_t row = 0; row < procs.size(); ++row) {
+            ProcessKey key = {procs.pid[row], procs.startTime[row]};
+            auto it = slotOf.find(key);
+            if (it == slotOf.end()) it = slotOf.emplace(key, allocate()).first;
+            Slot &slot = slots[it->second];
+            slot.generation = generation;
+            push(it->second, slot, (uint16_t)std::min(procs.cpu[row] * 100.0 + 0.5, 65535.0),
+                 (uint32_t)std::min<uint64_t>(procs.rssKb[row], UINT32_MAX));
+        }
+        for (auto it = slotOf.begin(); it != slotOf.end();) {
+            if (slots[it->second].generation == generation) {
+                ++it;
+                continue;
+            }
+            freeSlots.push_back(it->second);
+            it = slotOf.erase(it);
+        }
+    }
+
+    struct Stats {
+        double minCpu, avgCpu, maxCpu;
+    };
+
+    // Rolling CPU stats over the window; false if pid has no history yet.
+    bool stats(int pid, unsigned long long startTime, Stats &out) const {
+        const Slot *slot = find(pid, startTime);
+        if (!slot) return false;
+        unsigned base = slotIndex(slot) * length;
+        out.maxCpu = cpu[base + maxQueue[base + slot->maxHead]] / 100.0;
+        out.minCpu = cpu[base + minQueue[base + slot->minHead]] / 100.0;
+        out.avgCpu = (double)slot->cpuSum / slot->count / 100.0;
+        return true;
+    }
+
+    // Draws the newest ticks of CPU (scaled to the window's max, at least
+    // 1%) and RSS (scaled between the shown ticks' lowest and highest) as
+    // ASCII sparklines, newest on the right. Missing history is left blank.
+    void sparklines(int pid, unsigned long long startTime, char *cpuOut, unsigned cpuWidth, char *rssOut,
+                    unsigned rssWidth) const {
+        static const char ramp[] = " .:-=+*#%@";
+        memset(cpuOut, ' ', cpuWidth);
+        memset(rssOut, ' ', rssWidth);
+        cpuOut[cpuWidth] = rssOut[rssWidth] = '\0';
+        const Slot *slot = find(pid, startTime);
+        if (!slot) return;
+        unsigned base = slotIndex(slot) * length;
+        auto newest = [&](unsigned i) { return base + (slot->next + length - 1 - i) % length; };
+
+        double cpuScale = std::max<double>(cpu[base + maxQueue[base + slot->maxHead]], 100.0);
+        for (unsigned i = 0; i < std::min(cpuWidth, slot->count); ++i)
+            cpuOut[cpuWidth - 1 - i] = ramp[(int)(cpu[newest(i)] / cpuScale * 9 + 0.5)];
+
+        unsigned shown = std::min(rssWidth, slot->count);
+        uint32_t rssLow = UINT32_MAX, rssHigh = 0;
+        for (unsigned i = 0; i < shown; ++i) {
+            rssLow = std::min(rssLow, rss[newest(i)]);
+            rssHigh = std::max(rssHigh, rss[newest(i)]);
+        }
+        for (unsigned i = 0; i < shown; ++i)
+            rssOut[rssWidth - 1 - i] =
+                rssHigh > rssLow ? ramp[1 + (uint64_t)(rss[newest(i)] - rssLow) * 8 / (rssHigh - rssLow)] : ramp[1];
+    }
+
+private:
+    struct Slot {
+        unsigned long generation = 0;
+        uint32_t next = 0;   // ring position the next tick is written to
+        uint32_t count = 0;  // ticks held, up to length
+        uint64_t cpuSum = 0;
+        // Monotonic queues of ring positions, themselves rings of length
+        // entries: maxQueue's values decrease front to back, minQueue's increase.
+        uint32_t maxHead = 0, maxSize = 0, minHead = 0, minSize = 0;
+    };
+
+    unsigned allocate() {
+        if (freeSlots.empty()) {
+            size_t oldCount = slots.size(), newCount = std::max<size_t>(256, oldCount * 2);
+            slots.resize(newCount);
+            cpu.resize(newCount * length);
+            rss.resize(newCount * length);
+            maxQueue.resize(newCount * length);
+            minQueue.resize(newCount * length);
+            for (size_t i = newCount; i-- > oldCount;) freeSlots.push_back((unsigned)i);
+        }
+        unsigned index = freeSlots.back();
+        freeSlots.pop_back();
+        slots[index] = Slot();
+        return index;
+    }
+
+    void push(unsigned index, Slot &slot, uint16_t cpuValue, uint32_t rssValue) {
+        unsigned base = index * length;
+        uint32_t pos = slot.next;
+        if (slot.count == length) {  // the oldest tick falls out of the window
+            slot.cpuSum -= cpu[base + pos];
+            if (maxQueue[base + slot.maxHead] == pos) popFront(slot.maxHead, slot.maxSize);
+            if (minQueue[base + slot.minHead] == pos) popFront(slot.minHead, slot.minSize);
+        } else {
+            ++slot.count;
+        }
+        cpu[base + pos] = cpuValue;
+        rss[base + pos] = rssValue;
+        slot.cpuSum += cpuValue;
+        slot.next = (pos + 1) % length;
+
+        while (slot.maxSize && cpu[base + maxQueue[base + back(slot.maxHead, slot.maxSize)]] <= cpuValue) --slot.maxSize;
+        maxQueue[base + (slot.maxHead + slot.maxSize++) % length] = pos;
+        while (slot.minSize && cpu[base + minQueue[base + back(slot.minHead, slot.minSize)]] >= cpuValue) --slot.minSize;
+        minQueue[base + (slot.minHead + slot.minSize++) % length] = pos;
+    }
+
+    uint32_t back(uint32_t head, uint32_t size) const { return (head + size - 1) % length; }
+
+    void popFront(uint32_t &head, uint32_t &size) {
+        head = (head + 1) % length;
+        --size;
+    }
+
+    const Slot *find(int pid, unsigned long long startTime) const {
+        auto it = slotOf.find(ProcessKey{pid, startTime});
+        return it == slotOf.end() || slots[it->second].count == 0 ? nullptr : &slots[it->second];
+    }
+
+    unsigned slotIndex(const Slot *slot) const { return (unsigned)(slot - slots.data()); }
+
+    unsigned length;
+    unsigned long generation = 0;
+    std::vector<Slot> slots;
+    std::vector<uint16_t> cpu;       // centi-percent, slots x length
+    std::vector<uint32_t> rss;       // KB, slots x length
+    std::vector<uint16_t> maxQueue;  // ring positions, slots x length
+    std::vector<uint16_t> minQueue;
+    std::vector<unsigned> freeSlots;
+    std::unordered_map<ProcessKey, unsigned, ProcessKeyHash> slotOf;
+};
+
+// Formats one value column of a row, right-aligned to its heading, plus a separating blank.
+int formatCell(char *out, size_t size, Column column, const ProcessTable &procs, size_t row) {
+    int width = columnSpec(column).width;
+    switch (column) {
+    case Column::Cpu: return snprintf(out, size, "%*.1f ", width, procs.cpu[row]);
+    case Column::Rss: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.rssKb[row]);
+    case Column::Swap: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.swapKb[row]);
+    case Column::Vsz: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.vszKb[row]);
+    case Column::Threads: return snprintf(out, size, "%*u ", width, procs.threads[row]);
+    case Column::State: return snprintf(out, size, "%*c ", width, procs.state[row]);
+    case Column::DiskRead: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.io[row].readBps / 1024);
+    case Column::DiskWrite: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.io[row].writeBps / 1024);
+    case Column::Rchar: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.io[row].rcharBps / 1024);
+    case Column::Wchar: return snprintf(out, size, "%*llu ", width, (unsigned long long)procs.io[row].wcharBps / 1024);
+    case Column::Count: break;
+    }
+    return 0;
+}
+
+// Draws the header and as many process rows as fit above the footer, with
+// the threads of expanded processes listed under them. Returns the number
+// of lines drawn.
+int printProcessList(const ProcessTable &procs, const std::vector<RankedRow> &rows,
+                     const SampleOptions &options, Screen &screen, int footerRows,
+                     const ThreadRows *threads = nullptr, const ProcessHistory *history = nullptr,
+                     const char *idHeader = "PID", const char *nameHeader = "NAME", bool reuseUnchanged = false) {
+    const unsigned cpuSparkWidth = 16, rssSparkWidth = 8;
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%-8s ", idHeader);
+    forEachColumn(options.columns, [&](Column column) {
+        const ColumnSpec &spec = columnSpec(column);
+        len += snprintf(line + len, sizeof(line) - len, "%*s ", spec.width, spec.header);
+    });
+    if (history)
+        len += snprintf(line + len, sizeof(line) - len, "%-*s %5s %5s %5s %-*s ", cpuSparkWidth, "CPU HISTORY", "MIN",
+                        "AVG", "MAX", rssSparkWidth, "RSS");
+    len += snprintf(line + len, sizeof(line) - len, "%s", nameHeader);
+    screen.addLine(line, len);
+
+    int visible = std::max(0, screen.rows() - footerRows - 1);
+    int drawn = 0;
+    char cpuSpark[cpuSparkWidth + 1], rssSpark[rssSparkWidth + 1];
+    for (size_t i = 0; drawn < visible && i < rows.size(); ++i) {
+        size_t row = rows[i].index;
+        // Unchanged rows are only reusable when nothing on them moves per tick.
+        // The tag must be unique per process and nonzero: pid, start time (with
+        // an aggregated row's host id folded in from the top bits) and a marker bit.
+        unsigned long long start = procs.startTime[row];
+        uint64_t tag = history ? 0 : (uint64_t)(unsigned)procs.pid[row] << 32 | (uint32_t)(start ^ start >> 32) | 1ULL << 63;
+        if (!reuseUnchanged || procs.changed[row] || !screen.reuseLine(tag)) {
+            len = snprintf(line, sizeof(line), "%-8d ", procs.pid[row]);
+            forEachColumn(options.columns,
+                          [&](Column column) { len += formatCell(line + len, sizeof(line) - len, column, procs, row); });
+            if (history) {
+                ProcessHistory::Stats stats = {0, 0, 0};
+                history->stats(procs.pid[row], procs.startTime[row], stats);
+                history->sparklines(procs.pid[row], procs.startTime[row], cpuSpark, cpuSparkWidth, rssSpark,
+                                    rssSparkWidth);
+                len += snprintf(line + len, sizeof(line) - len, "%s %5.1f %5.1f %5.1f %s ", cpuSpark, stats.minCpu,
+                                stats.avgCpu, stats.maxCpu, rssSpark);
+            }
+            len += snprintf(line + len, sizeof(line) - len, "%s", procs.name(row).c_str());
+            screen.addLine(line, std::min(len, (int)sizeof(line) - 1), tag);
+        }
+        ++drawn;
+
+        const std::vector<unsigned> *tids = threads ? threads->threadsOf(procs.pid[row]) : nullptr;
+        if (!tids) continue;
+        const ProcessTable &table = threads->table;
+        int pad = history ? cpuSparkWidth + 19 + rssSparkWidth + 1 : 0;
+        for (size_t t = 0; drawn < visible && t < tids->size(); ++t) {
+            unsigned trow = (*tids)[t];
+            // Memory and thread counts are per process; threads show only their CPU and state
+            len = snprintf(line, sizeof(line), "  `-%-4d ", table.pid[trow]);
+            forEachColumn(options.columns, [&](Column column) {
+                if (column == Column::Cpu || column == Column::State)
+                    len += formatCell(line + len, sizeof(line) - len, column, table, trow);
+                else
+                    len += snprintf(line + len, sizeof(line) - len, "%*s ", columnSpec(column).width, "");
+            });
+            len += snprintf(line + len, sizeof(line) - len, "%*s%s", pad, "", table.name(trow).c_str());
+            screen.addLine(line, std::min(len, (int)sizeof(line) - 1));
+            ++drawn;
+        }
+    }
+    return drawn + 1;
+}
+
+// The ? overlay: what each of monitor's own threads has done since it
+// started, the cost of the last scan, and time per pipeline stage. Draws at
+// most maxRows lines and returns how many.
+int printProfile(Screen &screen, int maxRows) {
+    char line[256];
+    int drawn = 0;
+    auto add = [&](int len) {
+        if (drawn >= maxRows) return;
+        screen.addLine(line, std::max(0, std::min(len, (int)sizeof(line) - 1)));
+        ++drawn;
+    };
+    uint64_t scan[5];
+    for (int i = 0; i < 5; ++i) scan[i] = profiler.lastScan[i].load(std::memory_order_relaxed);
+    add(snprintf(line, sizeof(line), "last scan: %llu syscalls, %.1f KB read, %llu procs, parse %.2fms, %llu allocations",
+                 (unsigned long long)scan[0], scan[1] / 1024.0, (unsigned long long)scan[3], scan[2] / 1e6,
+                 (unsigned long long)scan[4]));
+    add(snprintf(line, sizeof(line), "%-15s %12s %12s %10s %12s %10s", "THREAD", "SYSCALLS", "READ(KB)", "PARSE(ms)",
+                 "PROCS", "ALLOCS"));
+    uint64_t stageNs[(int)Stage::Count] = {}, stageCalls[(int)Stage::Count] = {}, stageLastNs[(int)Stage::Count] = {};
+    for (size_t i = 0; i < profiler.size(); ++i) {
+        const ThreadProfile &thread = profiler.at(i);
+        for (int stage = 0; stage < (int)Stage::Count; ++stage) {
+            stageNs[stage] += thread.stageNs[stage].load(std::memory_order_relaxed);
+            stageCalls[stage] += thread.stageCalls[stage].load(std::memory_order_relaxed);
+            stageLastNs[stage] = std::max(stageLastNs[stage], thread.stageLastNs[stage].load(std::memory_order_relaxed));
+        }
+        if (thread.retired.load(std::memory_order_relaxed)) continue;
+        ProfileCounters c = thread.counters();
+        add(snprintf(line, sizeof(line), "%-15s %12llu %12.1f %10.2f %12llu %10llu", thread.name,
+                     (unsigned long long)c.syscalls, c.bytesRead / 1024.0, c.parseNs / 1e6,
+                     (unsigned long long)c.procsScanned, (unsigned long long)c.allocations));
+    }
+    add(0);
+    add(snprintf(line, sizeof(line), "%-15s %12s %12s %10s %12s", "STAGE", "CALLS", "LAST(ms)", "AVG(ms)", "TOTAL(ms)"));
+    for (int stage = 0; stage < (int)Stage::Count; ++stage) {
+        if (!stageCalls[stage]) continue;
+        add(snprintf(line, sizeof(line), "%-15s %12llu %12.3f %10.3f %12.1f", stageName(Stage(stage)),
+                     (unsigned long long)stageCalls[stage], stageLastNs[stage] / 1e6,
+                     stageNs[stage] / 1e6 / stageCalls[stage], stageNs[stage] / 1e6));
+    }
+    return drawn;
+}
+
+// Applies a NameMatcher to process tables. Match results are cached per
+// interned name id, so each distinct name is tested once for as long as the
+// filter stays the same, however many processes or ticks carry it.
+class NameFilter {
+public:
+    bool set(const std::string &newPattern, std::string &error) {
+        if (!matcher.compile(newPattern, error)) return false;
+        pattern = newPattern;
+        nameMatches.clear();
+        return true;
+    }
+
+    const std::string &text() const { return pattern; }
+
+    // Sets the table's selection to the rows whose name matches.
+    void apply(ProcessTable &procs) {
+        ProfileScope scope(Stage::Filter);
+        if (matcher.matchesAll()) {
+            procs.selectAll();
+            return;
+        }
+        if (nameMatches.size() < procs.names->size()) nameMatches.resize(procs.names->size(), -1);
+
+        std::fill(procs.selection.begin(), procs.selection.end(), 0);
+        procs.selectedCount = 0;
+        for (size_t row = 0; row < procs.size(); ++row) {
+            int8_t &match = nameMatches[procs.nameId[row]];
+            if (match < 0) match = matcher.matches(procs.name(row));
+            if (match) procs.select(row);
+        }
+    }
+
+private:
+    NameMatcher matcher;
+    std::string pattern;
+    std::vector<int8_t> nameMatches;  // by name id: -1 untested, else 0/1
+};
+
+enum class ExportFormat { None, Jsonl, Csv, Binary };
+
+struct ExportOptions {
+    ExportFormat format = ExportFormat::None;
+    std::chrono::milliseconds interval{1000};
+    std::string outputPath;  // empty means stdout
+    std::string filter;
+    long ticks = 0;  // stop after this many ticks; 0 runs until killed
+    bool delta = false;  // only rows that changed since the last tick, plus exits
+};
+
+// Binary export framing: every tick is one BinaryTickHeader followed by
+// recordCount fixed-width BinaryRecords, then exitCount BinaryExits, all in
+// host byte order. Only delta streams have exits; their frames are version 2.
+struct BinaryTickHeader {
+    char magic[4];  // "MONT"
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t recordCount;
+    uint32_t exitCount;  // 0 in version 1
+    uint64_t timestampNs;  // CLOCK_REALTIME
+};
+
+struct BinaryRecord {
+    int32_t pid;
+    uint32_t cpuCentiPercent;  // cpu% * 100
+    uint64_t rssKb;
+    uint64_t swapKb;
+    uint64_t startTime;  // jiffies since boot
+    char name[16];       // comm, NUL-padded
+};
+
+// A process that left the stream since the previous frame.
+struct BinaryExit {
+    int32_t pid;
+    uint32_t reserved;
+    uint64_t startTime;
+};
+
+static_assert(sizeof(BinaryTickHeader) == 24, "BinaryTickHeader layout changed");
+static_assert(sizeof(BinaryRecord) == 48, "BinaryRecord layout changed");
+static_assert(sizeof(BinaryExit) == 16, "BinaryExit layout changed");
+
+// First message on an --agent connection, ahead of its binary delta frames:
+// names the host the following processes belong to.
+struct AgentHello {
+    char magic[4];  // "MONH"
+    uint16_t version;
+    uint16_t hostLen;  // bytes of hostname that follow, no NUL; at most kMaxHostLen
+};
+
+constexpr uint16_t kMaxHostLen = 255;
+
+static_assert(sizeof(AgentHello) == 8, "AgentHello layout changed");
+
+// Append-only buffer that formats numbers by hand and reaches the fd in large
+// write() calls, so exporting a tick allocates nothing after construction.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 20) : fd(fd), data(capacity) {}
+
+    void put(char c) {
+        reserve(1);
+        data[used++] = c;
+    }
+
+    void put(const char *text, size_t len) {
+        if (len > data.size()) {
+            flush();
+            writeAll(text, len);
+            return;
+        }
+        reserve(len);
+        memcpy(data.data() + used, text, len);
+        used += len;
+    }
+
+    void put(const char *text) { put(text, strlen(text)); }
+
+    void putUnsigned(unsigned long long value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        reserve(n);
+        while (n) data[used++] = digits[--n];
+    }
+
+    void putSigned(long long value) {
+        if (value < 0) {
+            put('-');
+            putUnsigned(0ULL - (unsigned long long)value);
+        } else {
+            putUnsigned(value);
+        }
+    }
+
+    // Writes value rounded to two decimals, e.g. 12.5 -> "12.50".
+    void putFixed2(double value) {
+        if (value < 0) {
+            put('-');
+            value = -value;
+        }
+        unsigned long long scaled = (unsigned long long)(value * 100.0 + 0.5);
+        putUnsigned(scaled / 100);
+        put('.');
+        put('0' + scaled / 10 % 10);
+        put('0' + scaled % 10);
+    }
+
+    // Writes text as a quoted JSON string.
+    void putJsonString(const char *text, size_t len) {
+        static const char hex[] = "0123456789abcdef";
+        put('"');
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char ch = text[i];
+            if (ch == '"' || ch == '\\') {
+                put('\\');
+                put(ch);
+            } else if (ch < 0x20) {
+                put("\\u00", 4);
+                put(hex[ch >> 4]);
+                put(hex[ch & 0xf]);
+            } else {
+                put(ch);
+            }
+        }
+        put('"');
+    }
+
+    // Writes text as a CSV field, quoting it only when it needs to be.
+    void putCsvField(const char *text, size_t len) {
+        if (!memchr(text, ',', len) && !memchr(text, '"', len) && !memchr(text, '\n', len)) {
+            put(text, len);
+            return;
+        }
+        put('"');
+        for (size_t i = 0; i < len; ++i) {
+            if (text[i] == '"') put('"');
+            put(text[i]);
+        }
+        put('"');
+    }
+
+    bool flush() {
+        if (used) writeAll(data.data(), used);
+        used = 0;
+        return !failed;
+    }
+
+    bool ok() const { return !failed; }
+
+private:
+    void reserve(size_t len) {
+        if (used + len > data.size()) flush();
+    }
+
+    void writeAll(const char *buf, size_t len) {
+        while (len && !failed) {
+            ssize_t n = write(fd, buf, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                failed = true;
                 break;
             }
+            buf += n;
+            len -= n;
+        }
+    }
+
+    int fd;
+    std::vector<char> data;
+    size_t used = 0;
+    bool failed = false;
+};
+
+// Writes one value column of a row as a JSONL or CSV value.
+void exportCell(OutputBuffer &out, Column column, const ProcessTable &procs, size_t row, bool json) {
+    switch (column) {
+    case Column::Cpu: out.putFixed2(procs.cpu[row]); break;
+    case Column::Rss: out.putUnsigned(procs.rssKb[row]); break;
+    case Column::Swap: out.putUnsigned(procs.swapKb[row]); break;
+    case Column::Vsz: out.putUnsigned(procs.vszKb[row]); break;
+    case Column::Threads: out.putUnsigned(procs.threads[row]); break;
+    case Column::State:
+        if (json) out.put('"');
+        out.put(procs.state[row]);
+        if (json) out.put('"');
+        break;
+    case Column::DiskRead: out.putUnsigned(procs.io[row].readBps); break;
+    case Column::DiskWrite: out.putUnsigned(procs.io[row].writeBps); break;
+    case Column::Rchar: out.putUnsigned(procs.io[row].rcharBps); break;
+    case Column::Wchar: out.putUnsigned(procs.io[row].wcharBps); break;
+    case Column::Count: break;
+    }
+}
+
+// CSV header line for the given columns.
+std::string csvHeader(uint32_t columns) {
+    std::string header = "ts,pid,name";
+    forEachColumn(columns, [&](Column column) { header.append(",").append(columnSpec(column).field); });
+    return header + ",start\n";
+}
+
+// Appends one tick's worth of records to out in the chosen format, followed
+// by exits when given. Binary records have a fixed layout; the text formats
+// carry the chosen columns.
+void exportTick(OutputBuffer &out, ExportFormat format, const ProcessTable &procs, uint32_t columns,
+                std::chrono::system_clock::time_point now, bool delta = false,
+                const std::vector<ProcessKey> *exits = nullptr) {
+    ProfileScope scope(Stage::Export);
+    long long nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    long long nowMs = nowNs / 1000000;
+    auto emitted = [&](size_t row) { return procs.selected(row) && (!delta || procs.changed[row]); };
+
+    if (format == ExportFormat::Binary) {
+        size_t count = procs.selectedCount;
+        if (delta) {
+            count = 0;
+            for (size_t row = 0; row < procs.size(); ++row) count += emitted(row);
+        }
+        uint32_t exitCount = exits ? (uint32_t)exits->size() : 0;
+        BinaryTickHeader header = {{'M', 'O', 'N', 'T'}, (uint16_t)(exitCount ? 2 : 1), sizeof(BinaryRecord),
+                                   (uint32_t)count, exitCount, (uint64_t)nowNs};
+        out.put(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (size_t row = 0; row < procs.size(); ++row) {
+            if (!emitted(row)) continue;
+            const std::string &name = procs.name(row);
+            BinaryRecord record = {};
+            record.pid = procs.pid[row];
+            record.cpuCentiPercent = (uint32_t)(procs.cpu[row] * 100.0 + 0.5);
+            record.rssKb = procs.rssKb[row];
+            record.swapKb = procs.swapKb[row];
+            record.startTime = procs.startTime[row];
+            memcpy(record.name, name.data(), std::min(name.size(), sizeof(record.name) - 1));
+            out.put(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
+        for (uint32_t i = 0; i < exitCount; ++i) {
+            BinaryExit exit = {(*exits)[i].pid, 0, (*exits)[i].startTime};
+            out.put(reinterpret_cast<const char *>(&exit), sizeof(exit));
+        }
+        return;
+    }
+
+    for (size_t row = 0; row < procs.size(); ++row) {
+        if (!emitted(row)) continue;
+        const std::string &name = procs.name(row);
+        if (format == ExportFormat::Jsonl) {
+            out.put("{\"ts\":");
+            out.putSigned(nowMs);
+            out.put(",\"pid\":");
+            out.putSigned(procs.pid[row]);
+            out.put(",\"name\":");
+            out.putJsonString(name.data(), name.size());
+            forEachColumn(columns, [&](Column column) {
+                out.put(",\"");
+                out.put(columnSpec(column).field);
+                out.put("\":");
+                exportCell(out, column, procs, row, true);
+            });
+            out.put(",\"start\":");
+            out.putUnsigned(procs.startTime[row]);
+            out.put("}\n");
+        } else {
+            out.putSigned(nowMs);
+            out.put(',');
+            out.putSigned(procs.pid[row]);
+            out.put(',');
+            out.putCsvField(name.data(), name.size());
+            forEachColumn(columns, [&](Column column) {
+                out.put(',');
+                exportCell(out, column, procs, row, false);
+            });
+            out.put(',');
+            out.putUnsigned(procs.startTime[row]);
+            out.put('\n');
+        }
+    }
+
+    // CSV has no way to say a row went away
+    if (!exits || format != ExportFormat::Jsonl) return;
+    for (const ProcessKey &key : *exits) {
+        out.put("{\"ts\":");
+        out.putSigned(nowMs);
+        out.put(",\"pid\":");
+        out.putSigned(key.pid);
+        out.put(",\"start\":");
+        out.putUnsigned(key.startTime);
+        out.put(",\"exited\":true}\n");
+    }
+}
+
+// For delta streams: fills exits with every process in exported that isn't
+// selected any more, then replaces exported with the selected rows of this
+// tick. current is scratch space, kept by the caller so its capacity
+// carries over between ticks.
+void diffExits(const ProcessTable &procs, std::vector<ProcessKey> &exported, std::vector<ProcessKey> &current,
+               std::vector<ProcessKey> &exits) {
+    auto byPid = [](const ProcessKey &a, const ProcessKey &b) {
+        return a.pid != b.pid ? a.pid < b.pid : a.startTime < b.startTime;
+    };
+    current.clear();
+    for (size_t row = 0; row < procs.size(); ++row)
+        if (procs.selected(row)) current.push_back({procs.pid[row], procs.startTime[row]});
+    std::sort(current.begin(), current.end(), byPid);
+
+    exits.clear();
+    size_t j = 0;
+    for (const ProcessKey &key : exported) {
+        while (j < current.size() && byPid(current[j], key)) ++j;
+        if (j < current.size() && current[j] == key) continue;
+        exits.push_back(key);
+    }
+    exported.swap(current);
+}
+
+// Writes every profiled thread's trace ring as Chrome trace-event JSON, for
+// chrome://tracing or Perfetto: one complete event per timed stage, where
+// scan events carry what the pass cost as args. Timestamps are
+// CLOCK_MONOTONIC microseconds.
+bool writeTrace(const std::string &path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    OutputBuffer out(fd);
+    auto putMicros = [&](uint64_t ns) {
+        char fraction[4] = {'.', char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10)};
+        out.putUnsigned(ns / 1000);
+        out.put(fraction, sizeof(fraction));
+    };
+    bool first = true;
+    auto beginEvent = [&](const ThreadProfile &thread, const char *name, const char *phase) {
+        out.put(first ? "\n{\"name\":\"" : ",\n{\"name\":\"");
+        first = false;
+        out.put(name);
+        out.put("\",\"ph\":\"");
+        out.put(phase);
+        out.put("\",\"pid\":");
+        out.putSigned(getpid());
+        out.put(",\"tid\":");
+        out.putSigned(thread.tid);
+    };
+
+    out.put("{\"traceEvents\":[");
+    for (size_t i = 0; i < profiler.size(); ++i) {
+        const ThreadProfile &thread = profiler.at(i);
+        beginEvent(thread, "thread_name", "M");
+        out.put(",\"args\":{\"name\":");
+        out.putJsonString(thread.name, strlen(thread.name));
+        out.put("}}");
+        if (!thread.trace) continue;
+        uint64_t count = thread.traceCount.load(std::memory_order_acquire);
+        for (uint64_t n = count > ThreadProfile::kTraceEvents ? count - ThreadProfile::kTraceEvents : 0; n < count; ++n) {
+            const TraceEvent &event = thread.trace[n % ThreadProfile::kTraceEvents];
+            beginEvent(thread, stageName(event.stage), "X");
+            out.put(",\"ts\":");
+            putMicros(event.startNs);
+            out.put(",\"dur\":");
+            putMicros(event.durationNs);
+            if (event.stage == Stage::Scan) {
+                out.put(",\"args\":{\"syscalls\":");
+                out.putUnsigned(event.scan.syscalls);
+                out.put(",\"bytes_read\":");
+                out.putUnsigned(event.scan.bytesRead);
+                out.put(",\"parse_us\":");
+                out.putUnsigned(event.scan.parseNs / 1000);
+                out.put(",\"procs\":");
+                out.putUnsigned(event.scan.procsScanned);
+                out.put(",\"allocations\":");
+                out.putUnsigned(event.scan.allocations);
+                out.put('}');
+            }
+            out.put('}');
+        }
+    }
+    out.put("\n],\"displayTimeUnit\":\"ms\"}\n");
+    bool ok = out.flush();
+    close(fd);
+    return ok;
+}
+
+// Headless collector loop: samples on a fixed cadence and streams every
+// process to the export target until SIGINT/SIGTERM/SIGHUP, the output
+// closes, or the tick limit is reached.
+int runExport(const SampleOptions &options, const ExportOptions &exportOptions) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);  // before the sampler's workers start
+
+    int fd = STDOUT_FILENO;
+    if (!exportOptions.outputPath.empty()) {
+        fd = open(exportOptions.outputPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::perror(exportOptions.outputPath.c_str());
+            return 1;
+        }
+    }
+
+    auto sampler = makeSampler(options);
+    OutputBuffer out(fd);
+    ProcessTable procs;
+    NameFilter filter;
+    std::string error;
+    if (!filter.set(exportOptions.filter, error)) {
+        std::cerr << "Invalid filter: " << error << "\n";
+        return 1;
+    }
+
+    std::vector<ProcessKey> exported, scratch, exits;  // for --delta: what the consumer currently believes is alive
+    if (exportOptions.format == ExportFormat::Csv) {
+        out.put(csvHeader(options.columns).c_str());
+    }
+
+    auto nextTick = std::chrono::steady_clock::now();
+    for (long tick = 0; exportOptions.ticks == 0 || tick < exportOptions.ticks; ++tick) {
+        if (!getProcessList(procs, *sampler)) {
+            std::cerr << "Failed to read /proc.\n";
+            return 1;
+        }
+        filter.apply(procs);
+        auto now = std::chrono::system_clock::now();
+        if (exportOptions.delta) diffExits(procs, exported, scratch, exits);
+        exportTick(out, exportOptions.format, procs, options.columns, now, exportOptions.delta,
+                   exportOptions.delta ? &exits : nullptr);
+        if (!out.flush()) return 1;
+
+        nextTick += exportOptions.interval;
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - std::chrono::steady_clock::now());
+        long long waitNs = std::max(0LL, (long long)wait.count());
+        struct timespec timeout = {(time_t)(waitNs / 1000000000), (long)(waitNs % 1000000000)};
+        if (sigtimedwait(&signals, nullptr, &timeout) > 0) break;
+    }
+    if (fd != STDOUT_FILENO) close(fd);
+    return 0;
+}
+
+// Record file layout, host byte order:
+//
+//   tick block*  RecordTickHeader, name table, then one length-prefixed
+//                varint stream per column (pid, cpu, rss, [swap], start, name)
+//   tick index   uint64 file offset of every tick block
+//   trailer      RecordTrailer
+//
+// Rows are sorted by pid and every numeric column is stored as zigzag
+// deltas from the previous row. Only names used by the tick are in its name
+// table, so any tick decodes on its own and replay can jump straight to it.
+struct RecordTickHeader {
+    char magic[4];  // "MONR"
+    uint16_t version;
+    uint16_t flags;  // RecordHasSwap
+    uint32_t rowCount;
+    uint32_t nameCount;
+    uint32_t bodySize;  // bytes after this header
+    uint32_t reserved;
+    uint64_t timestampNs;  // CLOCK_REALTIME
+};
+
+struct RecordTrailer {
+    uint64_t indexOffset;
+    uint64_t tickCount;
+    char magic[4];  // "MONI"
+    uint32_t version;
+};
+
+static_assert(sizeof(RecordTickHeader) == 32, "RecordTickHeader layout changed");
+static_assert(sizeof(RecordTrailer) == 24, "RecordTrailer layout changed");
+
+const uint16_t RecordHasSwap = 1;
+
+// Read-only view of a record file through mmap. Ticks are decoded on
+// demand, so memory use doesn't grow with the file.
+class Recording {
+public:
+    Recording() = default;
+    Recording(const Recording &) = delete;
+    Recording &operator=(const Recording &) = delete;
+    ~Recording() {
+        if (base) munmap(const_cast<char *>(base), length);
+    }
+
+    // Maps path and locates its tick index. A file whose recorder died before
+    // writing the index is still readable; its ticks are found by walking
+    // the blocks once. Every indexed block is bounds-checked here, so later
+    // reads can trust the offsets; a file without a single tick is rejected.
+    bool open(const char *path) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        length = st.st_size;
+        void *map = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        base = static_cast<const char *>(map);
+
+        RecordTrailer trailer;
+        if (length >= sizeof(trailer)) {
+            memcpy(&trailer, base + length - sizeof(trailer), sizeof(trailer));
+            if (memcmp(trailer.magic, "MONI", 4) == 0 && trailer.tickCount > 0 &&
+                trailer.indexOffset <= length - sizeof(trailer) &&
+                trailer.tickCount == (length - sizeof(trailer) - trailer.indexOffset) / sizeof(uint64_t)) {
+                // The index sits wherever the last block ended, so it may be unaligned
+                index.resize(trailer.tickCount);
+                memcpy(index.data(), base + trailer.indexOffset, trailer.tickCount * sizeof(uint64_t));
+                bool valid = true;
+                for (size_t tick = 0; tick < index.size() && valid; ++tick)
+                    valid = validBlock(index[tick]) && index[tick] + blockSize(index[tick]) <= trailer.indexOffset;
+                if (valid) {
+                    ticks = index.size();
+                    end = trailer.indexOffset;
+                    return true;
+                }
+                index.clear();  // a corrupt index: walk the blocks instead
+            }
+        }
+
+        for (size_t offset = 0; validBlock(offset); offset += blockSize(offset)) index.push_back(offset);
+        ticks = index.size();
+        end = ticks ? index[ticks - 1] + blockSize(index[ticks - 1]) : 0;
+        return ticks > 0;
+    }
+
+    size_t tickCount() const { return ticks; }
+    const uint64_t *offsets() const { return index.data(); }
+    size_t dataEnd() const { return end; }  // where the next tick would be appended
+
+    uint64_t timestampNs(size_t tick) const { return header(tick).timestampNs; }
+    bool hasSwap(size_t tick) const { return header(tick).flags & RecordHasSwap; }
+
+    // First tick recorded at or after timestampNs, or the last tick.
+    size_t findTick(uint64_t timestampNs) const {
+        size_t lo = 0, hi = ticks - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (header(mid).timestampNs < timestampNs) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Decodes one tick into procs, interning its names into names.
+    bool load(size_t tick, ProcessTable &procs, NamePool &names) {
+        RecordTickHeader h = header(tick);
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(base + index[tick] + sizeof(h));
+        const uint8_t *bodyEnd = p + h.bodySize;
+
+        localNames.clear();
+        for (uint32_t i = 0; i < h.nameCount; ++i) {
+            if (p >= bodyEnd || bodyEnd - p - 1 < *p) return false;
+            localNames.push_back(names.intern(reinterpret_cast<const char *>(p + 1), *p));
+            p += 1 + *p;
+        }
+
+        bool withSwap = h.flags & RecordHasSwap;
+        ColumnReader pids, cpus, rss, swap, starts, nameIdx;
+        for (ColumnReader *c : {&pids, &cpus, &rss, &swap, &starts, &nameIdx}) {
+            if (c == &swap && !withSwap) continue;
+            uint32_t size;
+            if (bodyEnd - p < 4) return false;
+            memcpy(&size, p, 4);
+            if ((size_t)(bodyEnd - p - 4) < size) return false;
+            c->p = p + 4;
+            c->end = c->p + size;
+            p = c->end;
+        }
+
+        procs.clear();
+        procs.reserve(h.rowCount);
+        long long pid = 0, cpu = 0, rssKb = 0, swapKb = 0, start = 0;
+        for (uint32_t row = 0; row < h.rowCount; ++row) {
+            pid += pids.zigzag();
+            cpu += cpus.zigzag();
+            rssKb += rss.zigzag();
+            if (withSwap) swapKb += swap.zigzag();
+            start += starts.zigzag();
+            uint64_t name = nameIdx.varint();
+            if (pids.bad || cpus.bad || rss.bad || swap.bad || starts.bad || nameIdx.bad || name >= localNames.size())
+                return false;
+            procs.push((int)pid, cpu / 100.0, rssKb, swapKb, start, localNames[name]);
+        }
+        procs.names = &names;
+        procs.selectAll();
+        return true;
+    }
+
+private:
+    // Bounds-checked reader over one column's varint stream.
+    struct ColumnReader {
+        const uint8_t *p = nullptr, *end = nullptr;
+        bool bad = false;
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (p >= end) break;
+                uint8_t byte = *p++;
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return value;
+            }
+            bad = true;
+            return 0;
+        }
+
+        long long zigzag() {
+            uint64_t v = varint();
+            return (long long)(v >> 1) ^ -(long long)(v & 1);
+        }
+    };
+
+    RecordTickHeader header(size_t tick) const {
+        RecordTickHeader h;
+        memcpy(&h, base + index[tick], sizeof(h));
+        return h;
+    }
+
+    bool validBlock(size_t offset) const {
+        if (offset > length || length - offset < sizeof(RecordTickHeader)) return false;
+        RecordTickHeader h;
+        memcpy(&h, base + offset, sizeof(h));
+        return memcmp(h.magic, "MONR", 4) == 0 && h.bodySize <= length - offset - sizeof(h);
+    }
+
+    size_t blockSize(size_t offset) const {
+        RecordTickHeader h;
+        memcpy(&h, base + offset, sizeof(h));
+        return sizeof(h) + h.bodySize;
+    }
+
+    const char *base = nullptr;
+    size_t length = 0;
+    std::vector<uint64_t> index;  // block offset of each tick, all validated by open()
+    size_t ticks = 0;
+    size_t end = 0;
+    std::vector<uint32_t> localNames;  // this tick's name table as pool ids
+};
+
+// Appends ticks to a record file and writes the tick index on finish().
+// Reopening an existing recording keeps its ticks and carries on after them.
+class RecordWriter {
+public:
+    ~RecordWriter() {
+        if (fd >= 0) close(fd);
+    }
+
+    // Opens path for appending. Refuses a file that is neither empty nor a
+    // readable recording, so a mistyped --record never wipes anything.
+    bool open(const char *path, std::string &error) {
+        fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            error = strerror(errno);
+            return false;
+        }
+        if (st.st_size > 0) {
+            Recording existing;
+            if (!existing.open(path)) {
+                error = "not a monitor recording; refusing to overwrite it";
+                return false;
+            }
+            offsets.assign(existing.offsets(), existing.offsets() + existing.tickCount());
+            position = existing.dataEnd();
+        }
+        // Drops the old index (or a torn final tick); a new one is written on finish()
+        if (ftruncate(fd, position) != 0) {
+            error = strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool append(const ProcessTable &procs, bool withSwap, std::chrono::system_clock::time_point now) {
+        order.clear();
+        for (size_t row = 0; row < procs.size(); ++row)
+            if (procs.selected(row)) order.push_back((unsigned)row);
+        std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return procs.pid[a] < procs.pid[b]; });
+
+        // Tick-local name table: pool ids are numbered in order of first use
+        body.clear();
+        for (uint32_t id : usedNames) localIndex[id] = NamePool::kNone;
+        usedNames.clear();
+        if (localIndex.size() < procs.names->size()) localIndex.resize(procs.names->size(), NamePool::kNone);
+        for (unsigned row : order) {
+            uint32_t id = procs.nameId[row];
+            if (localIndex[id] != NamePool::kNone) continue;
+            localIndex[id] = (uint32_t)usedNames.size();
+            usedNames.push_back(id);
+            const std::string &name = procs.names->name(id);
+            size_t len = std::min<size_t>(name.size(), 255);
+            body.push_back((uint8_t)len);
+            body.insert(body.end(), name.begin(), name.begin() + len);
+        }
+
+        for (int column = 0; column < 6; ++column) {
+            if (column == 3 && !withSwap) continue;
+            size_t sizeAt = body.size();
+            body.resize(sizeAt + 4);
+            long long prev = 0;
+            for (unsigned row : order) {
+                if (column == 5) {
+                    putVarint(localIndex[procs.nameId[row]]);
+                    continue;
+                }
+                long long value = column == 0   ? procs.pid[row]
+                                  : column == 1 ? (long long)(procs.cpu[row] * 100.0 + 0.5)
+                                  : column == 2 ? (long long)procs.rssKb[row]
+                                  : column == 3 ? (long long)procs.swapKb[row]
+                                                : (long long)procs.startTime[row];
+                long long delta = value - prev;
+                prev = value;
+                putVarint(((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+            }
+            uint32_t size = (uint32_t)(body.size() - sizeAt - 4);
+            memcpy(body.data() + sizeAt, &size, 4);
+        }
+
+        RecordTickHeader header = {{'M', 'O', 'N', 'R'}, 1, (uint16_t)(withSwap ? RecordHasSwap : 0),
+                                   (uint32_t)order.size(), (uint32_t)usedNames.size(), (uint32_t)body.size(), 0,
+                                   (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count()};
+        if (!writeAt(&header, sizeof(header)) || !writeAt(body.data(), body.size())) return false;
+        offsets.push_back(position - sizeof(header) - body.size());
+        return true;
+    }
+
+    // Writes the tick index and trailer, making the file seekable.
+    bool finish() {
+        RecordTrailer trailer = {position, offsets.size(), {'M', 'O', 'N', 'I'}, 1};
+        return writeAt(offsets.data(), offsets.size() * sizeof(uint64_t)) && writeAt(&trailer, sizeof(trailer)) &&
+               fsync(fd) == 0;
+    }
+
+private:
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            body.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        body.push_back((uint8_t)value);
+    }
+
+    bool writeAt(const void *data, size_t len) {
+        const char *p = static_cast<const char *>(data);
+        while (len) {
+            ssize_t n = pwrite(fd, p, len, position);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+            position += n;
+        }
+        return true;
+    }
+
+    int fd = -1;
+    uint64_t position = 0;
+    std::vector<uint64_t> offsets;
+    std::vector<unsigned> order;
+    std::vector<uint8_t> body;
+    std::vector<uint32_t> localIndex;  // pool id -> this tick's name table slot
+    std::vector<uint32_t> usedNames;
+};
+
+// --record: samples on the export cadence and appends every tick to the
+// record file. SIGINT/SIGTERM/SIGHUP end the recording cleanly so the tick
+// index gets written.
+int runRecord(const SampleOptions &options, const ExportOptions &exportOptions, const std::string &path) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);  // before the sampler's workers start
+
+    RecordWriter writer;
+    std::string error;
+    if (!writer.open(path.c_str(), error)) {
+        std::cerr << path << ": " << error << "\n";
+        return 1;
+    }
+    auto sampler = makeSampler(options);
+    ProcessTable procs;
+    NameFilter filter;
+    if (!filter.set(exportOptions.filter, error)) {
+        std::cerr << "Invalid filter: " << error << "\n";
+        return 1;
+    }
+
+    int exitCode = 0;
+    auto nextTick = std::chrono::steady_clock::now();
+    for (long tick = 0; exportOptions.ticks == 0 || tick < exportOptions.ticks; ++tick) {
+        if (!getProcessList(procs, *sampler)) {
+            std::cerr << "Failed to read /proc.\n";
+            exitCode = 1;
+            break;
+        }
+        filter.apply(procs);
+        if (!writer.append(procs, options.readStatus, std::chrono::system_clock::now())) {
+            std::perror(path.c_str());
+            exitCode = 1;
+            break;
+        }
+
+        nextTick += exportOptions.interval;
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - std::chrono::steady_clock::now());
+        struct timespec timeout = {(time_t)(std::max(0LL, (long long)wait.count()) / 1000000000),
+                                   (long)(std::max(0LL, (long long)wait.count()) % 1000000000)};
+        if (sigtimedwait(&signals, nullptr, &timeout) > 0) break;
+    }
+    if (!writer.finish()) {
+        std::perror(path.c_str());
+        exitCode = 1;
+    }
+    return exitCode;
+}
+
+// Splits "[host]:port" (brackets optional, for IPv6) at the last colon.
+bool splitHostPort(const std::string &address, std::string &host, std::string &port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    return true;
+}
+
+// Opens a non-blocking listening socket on "[host]:port"; an empty host
+// means every interface. Returns the fd, or -1 with error set.
+int listenTcp(const std::string &address, std::string &error) {
+    std::string host, port;
+    if (!splitHostPort(address, host, port)) {
+        error = "expected [host]:port";
+        return -1;
+    }
+    struct addrinfo hints = {}, *found;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (rc != 0) {
+        error = gai_strerror(rc);
+        return -1;
+    }
+    int listenFd = -1;
+    for (struct addrinfo *ai = found; ai && listenFd < 0; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 128) == 0) listenFd = fd;
+        else close(fd);
+    }
+    freeaddrinfo(found);
+    if (listenFd < 0) error = strerror(errno);
+    return listenFd;
+}
+
+// Connects a blocking socket to "host:port". Sends give up after a few
+// seconds, so a stuck peer can't stall the caller forever. Returns the fd,
+// or -1 with error set.
+int connectTcp(const std::string &address, std::string &error) {
+    std::string host, port;
+    if (!splitHostPort(address, host, port) || host.empty()) {
+        error = "expected host:port";
+        return -1;
+    }
+    struct addrinfo hints = {}, *found;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+    if (rc != 0) {
+        error = gai_strerror(rc);
+        return -1;
+    }
+    int connected = -1;
+    for (struct addrinfo *ai = found; ai && connected < 0; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        struct timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) connected = fd;
+        else close(fd);
+    }
+    freeaddrinfo(found);
+    if (connected < 0) error = strerror(errno);
+    return connected;
+}
+
+// Minimal HTTP/1.1 server for Prometheus scrapes, on its own thread. The
+// sampling loop publishes each tick's rendered body once; every scrape that
+// tick gets the same immutable buffer, so scrapes never trigger a scan and
+// never wait on the sampler.
+class MetricsServer {
+public:
+    MetricsServer() = default;
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+    ~MetricsServer() {
+        if (thread.joinable()) {
+            uint64_t one = 1;
+            if (write(stopFd, &one, sizeof(one)) < 0) {}
+            thread.join();
+        }
+        for (int fd : {listenFd, epollFd, stopFd})
+            if (fd >= 0) close(fd);
+    }
+
+    // Listens on "[host]:port"; an empty host means every interface.
+    bool start(const std::string &address, std::string &error) {
+        listenFd = listenTcp(address, error);
+        if (listenFd < 0) return false;
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epollFd < 0 || stopFd < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.data.fd = stopFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev);
+        thread = std::thread(&MetricsServer::serve, this);
+        return true;
+    }
+
+    // Makes body the response for every scrape from now on.
+    void publish(std::shared_ptr<const std::string> body) { std::atomic_store(&current, std::move(body)); }
+
+private:
+    struct Connection {
+        char request[4096];
+        size_t received = 0;
+        std::shared_ptr<const std::string> body;  // pinned until fully sent
+        char head[160];
+        size_t headLen = 0;
+        size_t sent = 0;  // bytes of head + body written so far
+        bool responding = false;
+    };
+
+    void serve() {
+        profiler.attach("http");
+        struct epoll_event events[64];
+        while (true) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == stopFd) {
+                    for (auto &kv : connections) close(kv.first);
+                    return;
+                }
+                if (fd == listenFd) accept();
+                else handle(fd, events[i].events);
+            }
+        }
+    }
+
+    void accept() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+            connections[fd];
+        }
+    }
+
+    void handle(int fd, uint32_t events) {
+        Connection &conn = connections[fd];
+        if (!conn.responding) {
+            ssize_t n = recv(fd, conn.request + conn.received, sizeof(conn.request) - 1 - conn.received, 0);
+            countSyscalls(1, n);
+            if (n <= 0) {
+                if (n < 0 && errno == EAGAIN) return;
+                drop(fd);
+                return;
+            }
+            conn.received += n;
+            conn.request[conn.received] = '\0';
+            if (!strstr(conn.request, "\r\n\r\n")) {
+                if (conn.received == sizeof(conn.request) - 1) respond(fd, conn, "431 Request Header Fields Too Large");
+                return;
+            }
+            bool metrics = strncmp(conn.request, "GET /metrics ", 13) == 0 || strncmp(conn.request, "GET / ", 6) == 0;
+            if (!metrics) respond(fd, conn, "404 Not Found");
+            else {
+                conn.body = std::atomic_load(&current);
+                respond(fd, conn, conn.body ? "200 OK" : "503 Service Unavailable");
+            }
+            return;
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) flush(fd, conn);
+    }
+
+    void respond(int fd, Connection &conn, const char *status) {
+        size_t bodyLen = conn.body ? conn.body->size() : 0;
+        conn.headLen = snprintf(conn.head, sizeof(conn.head),
+                                "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                status, bodyLen);
+        conn.responding = true;
+        flush(fd, conn);
+    }
+
+    // Writes as much of the response as the socket takes, then waits for
+    // EPOLLOUT or closes once everything is out.
+    void flush(int fd, Connection &conn) {
+        size_t bodyLen = conn.body ? conn.body->size() : 0;
+        while (conn.sent < conn.headLen + bodyLen) {
+            struct iovec iov[2];
+            int count = 0;
+            if (conn.sent < conn.headLen) iov[count++] = {conn.head + conn.sent, conn.headLen - conn.sent};
+            size_t bodySent = conn.sent > conn.headLen ? conn.sent - conn.headLen : 0;
+            if (bodyLen > bodySent) iov[count++] = {const_cast<char *>(conn.body->data()) + bodySent, bodyLen - bodySent};
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            countSyscalls(1);
+            if (n < 0 && errno == EAGAIN) {
+                struct epoll_event ev = {};
+                ev.events = EPOLLOUT | EPOLLRDHUP;
+                ev.data.fd = fd;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+                return;
+            }
+            if (n <= 0) break;
+            conn.sent += n;
+        }
+        drop(fd);
+    }
+
+    void drop(int fd) {
+        connections.erase(fd);
+        close(fd);
+    }
+
+    int listenFd = -1, epollFd = -1, stopFd = -1;
+    std::thread thread;
+    std::shared_ptr<const std::string> current;  // only touched through atomic_load/atomic_store
+    std::unordered_map<int, Connection> connections;  // server thread only
+};
+
+// Appends a Prometheus label value, escaping backslash, quote and newline.
+void appendLabelValue(std::string &out, const std::string &value) {
+    for (char ch : value) {
+        if (ch == '\\' || ch == '"') out += '\\';
+        if (ch == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out += ch;
+    }
+}
+
+// Renders one tick of the selected rows in the Prometheus text format.
+void renderMetrics(std::string &out, const ProcessTable &procs, bool withSwap) {
+    ProfileScope scope(Stage::Export);
+    char number[48];
+    double totalCpu = 0;
+    unsigned long long totalRssKb = 0, totalSwapKb = 0;
+    for (size_t row = 0; row < procs.size(); ++row) {
+        if (!procs.selected(row)) continue;
+        totalCpu += procs.cpu[row];
+        totalRssKb += procs.rssKb[row];
+        totalSwapKb += procs.swapKb[row];
+    }
+
+    out += "# HELP monitor_processes Processes sampled in the last tick.\n# TYPE monitor_processes gauge\n";
+    snprintf(number, sizeof(number), "monitor_processes %zu\n", procs.selectedCount);
+    out += number;
+    out += "# HELP monitor_cpu_percent CPU use of all sampled processes, % of all CPUs.\n"
+           "# TYPE monitor_cpu_percent gauge\n";
+    snprintf(number, sizeof(number), "monitor_cpu_percent %.2f\n", totalCpu);
+    out += number;
+    out += "# HELP monitor_resident_memory_bytes Resident memory of all sampled processes.\n"
+           "# TYPE monitor_resident_memory_bytes gauge\n";
+    snprintf(number, sizeof(number), "monitor_resident_memory_bytes %llu\n", totalRssKb * 1024);
+    out += number;
+    if (withSwap) {
+        out += "# HELP monitor_swap_bytes Swapped-out memory of all sampled processes.\n"
+               "# TYPE monitor_swap_bytes gauge\n";
+        snprintf(number, sizeof(number), "monitor_swap_bytes %llu\n", totalSwapKb * 1024);
+        out += number;
+    }
+
+    struct Series {
+        const char *name, *help;
+    };
+    const Series series[] = {
+        {"monitor_process_cpu_percent", "CPU use over the last interval, % of all CPUs."},
+        {"monitor_process_resident_memory_bytes", "Resident memory."},
+        {"monitor_process_swap_bytes", "Swapped-out memory."},
+    };
+    for (int s = 0; s < (withSwap ? 3 : 2); ++s) {
+        out += "# HELP ";
+        out += series[s].name;
+        out += ' ';
+        out += series[s].help;
+        out += "\n# TYPE ";
+        out += series[s].name;
+        out += " gauge\n";
+        for (size_t row = 0; row < procs.size(); ++row) {
+            if (!procs.selected(row)) continue;
+            out += series[s].name;
+            snprintf(number, sizeof(number), "{pid=\"%d\",name=\"", procs.pid[row]);
+            out += number;
+            appendLabelValue(out, procs.name(row));
+            if (s == 0) snprintf(number, sizeof(number), "\"} %.2f\n", procs.cpu[row]);
+            else snprintf(number, sizeof(number), "\"} %llu\n",
+                          (unsigned long long)(s == 1 ? procs.rssKb[row] : procs.swapKb[row]) * 1024);
+            out += number;
+        }
+    }
+}
+
+// --serve: samples on the export cadence and serves each tick's metrics over
+// HTTP until SIGINT/SIGTERM/SIGHUP.
+int runServe(const SampleOptions &options, const ExportOptions &exportOptions, const std::string &address) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);  // before any thread starts
+
+    MetricsServer server;
+    std::string error;
+    if (!server.start(address, error)) {
+        std::cerr << "Failed to listen on " << address << ": " << error << "\n";
+        return 1;
+    }
+    auto sampler = makeSampler(options);
+    ProcessTable procs;
+    NameFilter filter;
+    if (!filter.set(exportOptions.filter, error)) {
+        std::cerr << "Invalid filter: " << error << "\n";
+        return 1;
+    }
+
+    size_t lastSize = 0;
+    auto nextTick = std::chrono::steady_clock::now();
+    while (true) {
+        if (!getProcessList(procs, *sampler)) {
+            std::cerr << "Failed to read /proc.\n";
+            return 1;
+        }
+        filter.apply(procs);
+        auto body = std::make_shared<std::string>();
+        body->reserve(lastSize + lastSize / 8);
+        renderMetrics(*body, procs, options.readStatus);
+        lastSize = body->size();
+        server.publish(std::move(body));
+
+        nextTick += exportOptions.interval;
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - std::chrono::steady_clock::now());
+        long long waitNs = std::max(0LL, (long long)wait.count());
+        struct timespec timeout = {(time_t)(waitNs / 1000000000), (long)(waitNs % 1000000000)};
+        if (sigtimedwait(&signals, nullptr, &timeout) > 0) return 0;
+    }
+}
+
+// Headless agent for --aggregate: samples like --export and streams binary
+// delta frames to the aggregator at address. A dropped connection is retried
+// every tick and restarts with a full frame, so the aggregator never has to
+// remember anything about an agent it lost. Runs until SIGINT/SIGTERM/SIGHUP.
+int runAgent(const SampleOptions &options, const ExportOptions &exportOptions, const std::string &address) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);  // before any thread starts
+    signal(SIGPIPE, SIG_IGN);  // a closed aggregator shows up as a failed write instead
+
+    char hostname[256] = {};
+    gethostname(hostname, sizeof(hostname) - 1);
+    AgentHello hello = {{'M', 'O', 'N', 'H'}, 1, (uint16_t)strlen(hostname)};
+
+    auto sampler = makeSampler(options);
+    ProcessTable procs;
+    NameFilter filter;
+    std::string error;
+    if (!filter.set(exportOptions.filter, error)) {
+        std::cerr << "Invalid filter: " << error << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<OutputBuffer> out;
+    int fd = -1;
+    bool connected = true;  // last reported state, so a down aggregator is logged once
+    std::vector<ProcessKey> exported, scratch, exits;  // what the aggregator currently believes is alive
+    auto nextTick = std::chrono::steady_clock::now();
+    while (true) {
+        if (!getProcessList(procs, *sampler)) {
+            std::cerr << "Failed to read /proc.\n";
+            return 1;
+        }
+        filter.apply(procs);
+
+        bool full = false;
+        if (fd < 0) {
+            fd = connectTcp(address, error);
+            if (fd >= 0) {
+                out = std::make_unique<OutputBuffer>(fd);
+                out->put(reinterpret_cast<const char *>(&hello), sizeof(hello));
+                out->put(hostname, hello.hostLen);
+                exported.clear();
+                full = true;
+                std::cerr << "Connected to " << address << ".\n";
+            } else if (connected) {
+                std::cerr << "Failed to connect to " << address << ": " << error << ", retrying.\n";
+            }
+            connected = fd >= 0;
+        }
+        if (fd >= 0) {
+            diffExits(procs, exported, scratch, exits);
+            exportTick(*out, ExportFormat::Binary, procs, options.columns, std::chrono::system_clock::now(), !full,
+                       &exits);
+            if (!out->flush()) {
+                std::cerr << "Lost the connection to " << address << ", reconnecting.\n";
+                out.reset();
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        nextTick += exportOptions.interval;
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - std::chrono::steady_clock::now());
+        long long waitNs = std::max(0LL, (long long)wait.count());
+        struct timespec timeout = {(time_t)(waitNs / 1000000000), (long)(waitNs % 1000000000)};
+        if (sigtimedwait(&signals, nullptr, &timeout) > 0) break;
+    }
+    if (fd >= 0) close(fd);
+    return 0;
+}
+
+// A /proc lookalike under a temporary directory, holding count processes,
+// so the pipeline can be benchmarked at scales the host doesn't have.
+class FakeProcTree {
+public:
+    explicit FakeProcTree(unsigned count) {
+        const char *base = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+        snprintf(path, sizeof(path), "%s/monitor-bench-XXXXXX", base);
+        if (!mkdtemp(path)) {
+            path[0] = '\0';
+            return;
+        }
+        // The host-wide files the summary panel reads, so its stage parses something real
+        created = writeFile("stat", "cpu  100000 0 50000 800000 0 0 0 0 0 0\n"
+                                    "cpu0 25000 0 12500 200000 0 0 0 0 0 0\ncpu1 25000 0 12500 200000 0 0 0 0 0 0\n"
+                                    "cpu2 25000 0 12500 200000 0 0 0 0 0 0\ncpu3 25000 0 12500 200000 0 0 0 0 0 0\n"
+                                    "intr 0\nctxt 0\nbtime 0\nprocesses 0\nprocs_running 1\nprocs_blocked 0\n") &&
+                  writeFile("meminfo", "MemTotal:       16384000 kB\nMemFree:         8192000 kB\n"
+                                       "MemAvailable:   12288000 kB\nBuffers:          512000 kB\n"
+                                       "Cached:          2048000 kB\nSwapCached:            0 kB\n"
+                                       "SwapTotal:       4096000 kB\nSwapFree:        4096000 kB\n") &&
+                  writeFile("loadavg", "0.50 0.40 0.30 1/200 12345\n") &&
+                  mkdirat(AT_FDCWD, (std::string(path) + "/pressure").c_str(), 0755) == 0;
+        const char *pressure = "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+                               "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+        for (const char *file : {"pressure/cpu", "pressure/memory", "pressure/io"}) created = created && writeFile(file, pressure);
+        char dir[32], status[512];
+        for (unsigned i = 0; created && i < count; ++i) {
+            unsigned pid = 1000 + i;
+            snprintf(dir, sizeof(dir), "%u", pid);
+            if (mkdirat(AT_FDCWD, (std::string(path) + "/" + dir).c_str(), 0755) != 0) created = false;
+            int statusLen = snprintf(status, sizeof(status),
+                                     "Name:\tbench-%u\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%u\nPid:\t%u\n"
+                                     "PPid:\t1\nVmPeak:\t  102400 kB\nVmSize:\t  102400 kB\nVmRSS:\t  %6u kB\n"
+                                     "VmSwap:\t       %u kB\nThreads:\t1\n",
+                                     i % 48, pid, pid, (200 + i % 4000) * 4, i % 3 ? 0 : i % 128);
+            created = created && writeStat(i, 0) && writeFile((std::string(dir) + "/status").c_str(), status, statusLen);
+        }
+        processes = count;
+    }
+
+    ~FakeProcTree() {
+        if (path[0]) nftw(path, [](const char *p, const struct stat *, int, struct FTW *) { return remove(p); }, 64,
+                          FTW_DEPTH | FTW_PHYS);
+    }
+
+    bool ok() const { return created; }
+    const char *root() const { return path; }
+
+    // Every process whose stat changes per churn() call, 1 in kChurnEvery
+    static constexpr unsigned kChurnEvery = 10;
+
+    // Bumps utime in a rotating tenth of the stat files, so ticks keep
+    // parsing instead of all taking the unchanged-stat shortcut, as on a
+    // host where some processes are always busy.
+    void churn(unsigned tick) {
+        for (unsigned i = tick % kChurnEvery; i < processes; i += kChurnEvery) writeStat(i, tick + 1);
+    }
+
+private:
+    bool writeStat(unsigned i, unsigned busyTicks) {
+        unsigned pid = 1000 + i;
+        char name[32], stat[512];
+        snprintf(name, sizeof(name), "%u/stat", pid);
+        // A few dozen distinct names, like a real host where most processes share a handful
+        int len = snprintf(stat, sizeof(stat),
+                           "%u (bench-%u) S 1 %u %u 0 -1 4194560 %u 0 0 0 %u %u 0 0 20 0 1 0 %u 104857600 %u "
+                           "18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+                           pid, i % 48, pid, pid, i * 7 % 1000, i % 500 + busyTicks, i % 97, 5000 + i, 200 + i % 4000);
+        return writeFile(name, stat, len);
+    }
+
+    bool writeFile(const char *name, const char *text, int len = -1) {
+        int fd = openat(AT_FDCWD, (std::string(path) + "/" + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        size_t size = len < 0 ? strlen(text) : (size_t)len;
+        bool ok = write(fd, text, size) == (ssize_t)size;
+        close(fd);
+        return ok;
+    }
+
+    char path[64];
+    bool created = false;
+    unsigned processes = 0;
+};
+
+// Counts syscalls made by this process through the raw_syscalls:sys_enter
+// tracepoint. Threads started after construction are included. Reads 0 when
+// tracefs or perf events aren't available.
+class SyscallCounter {
+public:
+    SyscallCounter() {
+        char buf[32];
+        if (readProcFile("/sys/kernel/tracing/events/raw_syscalls/sys_enter/id", buf, sizeof(buf)) <= 0 &&
+            readProcFile("/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id", buf, sizeof(buf)) <= 0)
+            return;
+        struct perf_event_attr attr = {};
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = strtoull(buf, nullptr, 10);
+        attr.inherit = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    ~SyscallCounter() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool available() const { return fd >= 0; }
+
+    unsigned long long value() const {
+        uint64_t count = 0;
+        if (fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+// Returns the sample at the given fraction of the way up, partially reordering samples.
+double percentile(std::vector<double> &samples, double fraction) {
+    size_t i = std::min(samples.size() - 1, (size_t)(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+    return samples[i];
+}
+
+// Runs the whole tick pipeline (sample, summary, filter, sort, render)
+// against procRoot and prints p50/p99 per stage plus allocations and syscalls
+// per tick. Render includes present(), with stdout sent to /dev/null for the
+// duration. With a synthetic tree, part of it churns between ticks (not counted).
+bool benchPipeline(const char *label, const SampleOptions &options, const std::string &pattern,
+                   FakeProcTree *tree = nullptr) {
+    SyscallCounter syscalls;  // before the sampler starts its workers, so they're counted too
+    ProcessTable procs;
+    auto sampler = makeSampler(options);
+    NameFilter filter;
+    std::string error;
+    filter.set(pattern, error);
+    Screen screen;
+    HostSummary summary;
+    std::vector<RankedRow> ranked;
+    const int footerRows = 4;
+    std::cout.flush();
+    int savedStdout = dup(STDOUT_FILENO), devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (savedStdout >= 0 && devNull >= 0) dup2(devNull, STDOUT_FILENO);
+    if (devNull >= 0) close(devNull);
+    auto restoreStdout = [&] {
+        if (savedStdout < 0) return;
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+        savedStdout = -1;
+    };
+
+    // One pass of the pipeline, with a timestamp between stages
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point marks[7];
+    auto runTick = [&] {
+        marks[0] = Clock::now();
+        bool ok = getProcessList(procs, *sampler);
+        marks[1] = Clock::now();
+        summary.update();
+        marks[2] = Clock::now();
+        filter.apply(procs);
+        marks[3] = Clock::now();
+        screen.beginFrame();
+        int summaryRows = summary.render(screen);
+        marks[4] = Clock::now();
+        rankTopK(procs, SortKey::Cpu, std::max(0, screen.rows() - footerRows - summaryRows - 1), ranked);
+        marks[5] = Clock::now();
+        printProcessList(procs, ranked, options, screen, footerRows + summaryRows);
+        screen.present();
+        marks[6] = Clock::now();
+        return ok;
+    };
+
+    // Warm-up ticks fill the history and fd cache and grow every buffer the
+    // pipeline reuses (both screen frames among them), so what's counted
+    // below is the steady state
+    for (int i = 0; i < 2; ++i) {
+        if (!runTick()) {
+            restoreStdout();
+            std::cerr << "Failed to read " << procRoot << ".\n";
+            return false;
+        }
+    }
+
+    const int ticks = (int)std::min<size_t>(500, std::max<size_t>(10, 200000 / std::max<size_t>(procs.size(), 1)));
+    const char *stageNames[] = {"sample", "summary", "filter", "sort", "render"};
+    const int stageCount = 5;
+    std::vector<double> stages[stageCount];
+    for (auto &s : stages) s.reserve(ticks);
+    unsigned long long allocsBefore = heapAllocations.load(std::memory_order_relaxed);
+    unsigned long long syscallsBefore = syscalls.value();
+    uint64_t countedBefore = profiler.totals().syscalls;
+    unsigned long long churnAllocs = 0, churnSyscalls = 0;
+
+    auto ms = [&](int from, int to) {
+        return std::chrono::duration<double, std::milli>(marks[to] - marks[from]).count();
+    };
+    for (int i = 0; i < ticks; ++i) {
+        if (tree) {
+            unsigned long long allocs = heapAllocations.load(std::memory_order_relaxed), calls = syscalls.value();
+            tree->churn(i);
+            churnAllocs += heapAllocations.load(std::memory_order_relaxed) - allocs;
+            churnSyscalls += syscalls.value() - calls;
         }
+        runTick();
+        // The frame is started and the panel drawn before the rows are ranked; both count as render
+        double times[] = {ms(0, 1), ms(1, 2), ms(2, 3), ms(4, 5), ms(3, 4) + ms(5, 6)};
+        for (int s = 0; s < stageCount; ++s) stages[s].push_back(times[s]);
+    }
+
+    restoreStdout();
+
+    double allocs = (double)(heapAllocations.load(std::memory_order_relaxed) - allocsBefore - churnAllocs) / ticks;
+    std::cout << label << ": procs=" << procs.size() << " threads=" << options.threads << " ticks=" << ticks
+              << "  allocs/tick=" << allocs << "  syscalls/tick=";
+    if (syscalls.available()) std::cout << (double)(syscalls.value() - syscallsBefore - churnSyscalls) / ticks << "\n";
+    else std::cout << "~" << (double)(profiler.totals().syscalls - countedBefore) / ticks << " (counted; no perf_event_open)\n";
+    char line[96];
+    for (int s = 0; s < stageCount; ++s) {
+        snprintf(line, sizeof(line), "  %-7s p50=%8.3f ms  p99=%8.3f ms\n", stageNames[s], percentile(stages[s], 0.5),
+                 percentile(stages[s], 0.99));
+        std::cout << line;
+    }
+    return true;
+}
+
+// Times the sample stage alone with 1, 2, 4, ... up to options.threads
+// workers, to show how the scan scales with --threads.
+bool benchScanThreads(const SampleOptions &options, FakeProcTree *tree = nullptr) {
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < options.threads; n *= 2) counts.push_back(n);
+    counts.push_back(options.threads);
 
-        procs.push_back({pid, comm.substr(1, comm.length() - 2), cpuUsage, (double)ramUsage});
+    ProcessTable procs;
+    for (unsigned threads : counts) {
+        SampleOptions sweep = options;
+        sweep.threads = threads;
+        auto sampler = makeSampler(sweep);
+        for (int i = 0; i < 2; ++i) {  // warm-up ticks fill the history and fd cache
+            if (!getProcessList(procs, *sampler)) {
+                std::cerr << "Failed to read " << procRoot << ".\n";
+                return false;
+            }
+        }
+        const int ticks = (int)std::min<size_t>(200, std::max<size_t>(10, 100000 / std::max<size_t>(procs.size(), 1)));
+        std::vector<double> scans;
+        scans.reserve(ticks);
+        for (int i = 0; i < ticks; ++i) {
+            if (tree) tree->churn(i);
+            auto start = std::chrono::steady_clock::now();
+            getProcessList(procs, *sampler);
+            scans.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        char line[96];
+        snprintf(line, sizeof(line), "  sample threads=%-3u p50=%8.3f ms  p99=%8.3f ms\n", threads, percentile(scans, 0.5),
+                 percentile(scans, 0.99));
+        std::cout << line;
     }
     return true;
 }
 
-void printProcessList(const std::vector<ProcessInfo> &procs) {
-    std::cout << "\033[2J\033[1;1H";  // Clear screen
-    std::cout << "PID     CPU%     RAM(KB)     NAME\n";
-    for (const auto &proc : procs) {
-        std::cout << proc.pid << "     " 
-                  << proc.cpuUsage << "     " 
-                  << proc.ramUsage << "     " 
-                  << proc.name << "\n";
+// --bench: the pipeline against the live /proc, then against synthetic
+// trees of each size in fakeCounts, each followed by a thread-count sweep of
+// the scan. The live pass filters only with --filter; the synthetic ones
+// default to "bench-1", which matches about a fifth of their processes.
+int runBench(const SampleOptions &base, const std::vector<unsigned> &fakeCounts, const std::string &pattern) {
+    SampleOptions options = base;
+    if (!options.threads) options.threads = std::max(1u, std::thread::hardware_concurrency());
+    if (!benchPipeline("live /proc", options, pattern) || !benchScanThreads(options)) return 1;
+
+    for (unsigned count : fakeCounts) {
+        FakeProcTree tree(count);
+        if (!tree.ok()) {
+            std::cerr << "Failed to build a synthetic /proc with " << count << " processes.\n";
+            return 1;
+        }
+        // Only the process scan reads procRoot; the other backends watch the live system
+        SampleOptions fakeOptions = options;
+        fakeOptions.backend = "proc";
+        procRoot = tree.root();
+        std::string label = "fake " + std::to_string(count) + " (1 in " + std::to_string(FakeProcTree::kChurnEvery) +
+                            " stats change per tick)";
+        std::string fakePattern = pattern.empty() ? "bench-1" : pattern;
+        bool ok = benchPipeline(label.c_str(), fakeOptions, fakePattern, &tree) && benchScanThreads(fakeOptions, &tree);
+        procRoot = "/proc";
+        if (!ok) return 1;
     }
+    return 0;
 }
 
-char getNonBlockingInput() {
-    char input = 0;
-    struct termios old_tio, new_tio;
+// Parses "250ms", "2s" or a bare number of seconds; returns 0ms if malformed.
+std::chrono::milliseconds parseInterval(const std::string &text) {
+    char *end;
+    double value = strtod(text.c_str(), &end);
+    std::string unit(end);
+    if (end == text.c_str() || value <= 0) return std::chrono::milliseconds(0);
+    if (unit == "ms") return std::chrono::milliseconds((long long)value);
+    if (unit == "s" || unit.empty()) return std::chrono::milliseconds((long long)(value * 1000));
+    return std::chrono::milliseconds(0);
+}
 
-    tcgetattr(STDIN_FILENO, &old_tio);
-    new_tio = old_tio;
+// Switches the terminal to non-canonical, no-echo input for the lifetime of
+// the object. A no-op when stdin isn't a terminal.
+class RawTerminal {
+public:
+    RawTerminal() {
+        active = tcgetattr(STDIN_FILENO, &saved) == 0;
+        enable();
+    }
+    ~RawTerminal() { restore(); }
 
-    new_tio.c_lflag &= (~ICANON & ~ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
-    int byteswaiting;
-    ioctl(STDIN_FILENO, FIONREAD, &byteswaiting);
+    void enable() {
+        if (!active) return;
+        struct termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
 
-    if (byteswaiting > 0) {
-        read(STDIN_FILENO, &input, 1);
+    void restore() {
+        if (active) tcsetattr(STDIN_FILENO, TCSANOW, &saved);
     }
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
-    return input;
+private:
+    struct termios saved;
+    bool active = false;
+};
+
+// Arms fd to fire every interval, starting one interval from now.
+void armTimer(int fd, std::chrono::milliseconds interval) {
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = interval.count() % 1000 * 1000000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(fd, 0, &spec, nullptr);
 }
 
-int main() {
-    std::vector<ProcessInfo> procs;
-    bool sortByCPU = true;
-    int refreshInterval = 1;
-    std::string filterString;
+// Picks the TUI's sampling interval. The user sets a base interval with +/-;
+// with a CPU budget, the interval stretches whenever monitor's own CPU time
+// per tick would otherwise exceed budget percent of one core.
+class RefreshScheduler {
+public:
+    using Millis = std::chrono::milliseconds;
 
-    while (true) {
-        if (!getProcessList(procs)) {
-            std::cerr << "Failed to read /proc.\n";
+    RefreshScheduler(Millis base, double budgetPercent) : budget(budgetPercent / 100) {
+        step = 0;
+        while (step + 1 < stepCount && steps[step] < base.count()) ++step;
+        current = requested();
+    }
+
+    Millis requested() const { return Millis(steps[step]); }
+    Millis interval() const { return current; }
+    double budgetPercent() const { return budget * 100; }
+
+    // Moves the base interval one step longer or shorter.
+    void adjust(bool longer) {
+        step = longer ? std::min(step + 1, stepCount - 1) : std::max(step - 1, 0);
+        retarget();
+    }
+
+    // Feeds in the process CPU seconds one tick cost. Returns whether the
+    // interval moved enough that the timer should be re-armed.
+    bool update(double tickCpuSeconds) {
+        tickCost = tickCost > 0 ? tickCost * 0.7 + tickCpuSeconds * 0.3 : tickCpuSeconds;
+        Millis before = current;
+        retarget();
+        long long diff = std::llabs((long long)(current - before).count());
+        return diff * 10 > before.count();  // ignore jitter under 10%
+    }
+
+private:
+    void retarget() {
+        current = requested();
+        if (budget <= 0) return;
+        Millis needed((long long)(tickCost / budget * 1000));
+        current = std::min(std::max(current, needed), Millis(steps[stepCount - 1]));
+    }
+
+    static constexpr int stepCount = 10;
+    static constexpr long long steps[stepCount] = {100, 200, 250, 500, 1000, 2000, 3000, 5000, 7500, 10000};
+    int step;
+    double budget;         // fraction of one core; 0 disables stretching
+    double tickCost = 0;   // smoothed CPU seconds per tick
+    Millis current;
+};
+
+// Process CPU time (all threads) in seconds.
+double processCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Shows prompt on a cooked terminal and reads one line of input.
+std::string promptLine(RawTerminal &terminal, const char *prompt) {
+    std::string line;
+    terminal.restore();
+    std::cout << "\n" << prompt << std::flush;
+    std::getline(std::cin, line);
+    terminal.enable();
+    return line;
+}
+
+// One finished tick, as handed from the sampler thread to the UI.
+struct Snapshot {
+    ProcessTable procs;
+    bool ok = false;  // false when /proc couldn't be read
+    unsigned long long heapAllocations = 0;
+    double scanMs = 0;
+    unsigned agents = 0;  // hosts merged into the tick, with --aggregate
+    // Read along with the tick for whichever local panels are showing
+    bool hasSummary = false;
+    HostStats summary;
+    ThreadRows threads;    // of the expanded processes
+    ProcessTable cgroups;  // one row per cgroup, when grouping by cgroup
+};
+
+// Moves snapshots from one writer thread to one reader thread without
+// locks. Three slots rotate between writer, pending and reader; publishing
+// and picking up are each one atomic exchange on the pending slot, so
+// neither side ever waits and the tables inside are reused forever.
+class TripleBuffer {
+public:
+    Snapshot &writeSlot() { return slots[back]; }
+
+    // Makes the write slot the pending one and takes the old pending slot back.
+    void publish() { back = pending.exchange(back | kFresh, std::memory_order_acq_rel) & kIndex; }
+
+    // Swaps in the pending slot if it was published since the last call.
+    bool acquire() {
+        if (!(pending.load(std::memory_order_acquire) & kFresh)) return false;
+        front = pending.exchange(front, std::memory_order_acq_rel) & kIndex;
+        return true;
+    }
+
+    Snapshot &readSlot() { return slots[front]; }
+
+private:
+    static constexpr unsigned kIndex = 3, kFresh = 4;
+    Snapshot slots[3];
+    std::atomic<unsigned> pending{1};
+    unsigned back = 0;   // writer only
+    unsigned front = 2;  // reader only
+};
+
+// Where the TUI's live ticks come from: a thread that publishes each one
+// through a TripleBuffer and announces it on readyFd().
+class SnapshotSource {
+public:
+    SnapshotSource() { notifyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); }
+    SnapshotSource(const SnapshotSource &) = delete;
+    SnapshotSource &operator=(const SnapshotSource &) = delete;
+    virtual ~SnapshotSource() {
+        if (notifyFd >= 0) close(notifyFd);
+    }
+
+    virtual bool started() const = 0;
+    int readyFd() const { return notifyFd; }
+    TripleBuffer &snapshots() { return buffer; }
+
+    virtual void setInterval(std::chrono::milliseconds interval) = 0;
+    // Takes a tick now instead of waiting for the timer, e.g. after a kill.
+    virtual void requestSample() = 0;
+    virtual void setExtraReads(unsigned) {}
+    virtual void setSortKey(SortKey) {}
+    // What to read with each tick besides the process table. Only a local
+    // sampler has a host to read them from; the filter decides which rows
+    // the cgroup rollups cover.
+    virtual void setFilter(const std::string &) {}
+    virtual void setSummary(bool) {}
+    virtual void setGroupByCgroup(bool) {}
+    virtual void toggleThreads(int) {}
+
+protected:
+    void announce() {
+        buffer.publish();
+        uint64_t one = 1;
+        if (write(notifyFd, &one, sizeof(one)) < 0) {}
+    }
+
+    TripleBuffer buffer;
+    int notifyFd = -1;
+};
+
+// Runs the sampler on its own thread on a timerfd cadence, so a slow scan
+// never stalls input or rendering. The thread also reads the summary panel,
+// expanded threads and cgroup rollups, and the UI only draws them.
+class SamplerThread : public SnapshotSource {
+public:
+    SamplerThread(const SampleOptions &options, std::chrono::milliseconds interval)
+        : sampler(makeSampler(options)) {
+        std::string error;
+        filter.set(options.filter, error);
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        wakeFd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);  // starts signalled: sample right away
+        if (timerFd < 0 || wakeFd < 0 || notifyFd < 0) return;
+        armTimer(timerFd, interval);
+        thread = std::thread(&SamplerThread::run, this);
+    }
+    ~SamplerThread() override {
+        if (thread.joinable()) {
+            stopping.store(true, std::memory_order_relaxed);
+            requestSample();
+            thread.join();
+        }
+        for (int fd : {timerFd, wakeFd})
+            if (fd >= 0) close(fd);
+    }
+
+    bool started() const override { return thread.joinable(); }
+    void setInterval(std::chrono::milliseconds interval) override { armTimer(timerFd, interval); }
+    void setExtraReads(unsigned reads) override { sampler->extraReads.store(reads, std::memory_order_relaxed); }
+    void setSummary(bool on) override { readSummary.store(on, std::memory_order_relaxed); }
+    void setGroupByCgroup(bool on) override { readCgroups.store(on, std::memory_order_relaxed); }
+
+    void setFilter(const std::string &pattern) override {
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        pendingFilter = pattern;
+        filterChanged = true;
+    }
+
+    void toggleThreads(int pid) override {
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        pendingToggles.push_back(pid);
+    }
+
+    void requestSample() override {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {}
+    }
+
+private:
+    void run() {
+        profiler.attach("sampler");
+        while (!stopping.load(std::memory_order_relaxed)) {
+            struct pollfd fds[2] = {{timerFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0 && errno != EINTR) return;
+            uint64_t count;
+            if ((fds[0].revents & POLLIN) && read(timerFd, &count, sizeof(count)) < 0) {}
+            if ((fds[1].revents & POLLIN) && read(wakeFd, &count, sizeof(count)) < 0) {}
+            if (stopping.load(std::memory_order_relaxed)) return;
+
+            Snapshot &slot = buffer.writeSlot();
+            unsigned long long allocsBefore = heapAllocations.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            bool ok = slot.ok = getProcessList(slot.procs, *sampler);
+            slot.scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            slot.heapAllocations = heapAllocations.load(std::memory_order_relaxed) - allocsBefore;
+            if (ok) readPanels(slot);
+            announce();
+            if (!ok) return;  // slot belongs to the reader once published
+        }
+    }
+
+    void readPanels(Snapshot &slot) {
+        {
+            std::lock_guard<std::mutex> lock(requestsMutex);
+            if (filterChanged) {
+                std::string error;  // the UI only passes on filters that compiled
+                filter.set(pendingFilter, error);
+                filterChanged = false;
+            }
+            for (int pid : pendingToggles) threads.toggle(pid);
+            pendingToggles.clear();
+        }
+        threads.sample(slot.threads);
+        slot.hasSummary = readSummary.load(std::memory_order_relaxed);
+        if (slot.hasSummary) {
+            summary.update();
+            slot.summary = summary.stats();
+        }
+        slot.cgroups.clear();
+        if (readCgroups.load(std::memory_order_relaxed)) {
+            filter.apply(slot.procs);  // rollups cover only the selected rows
+            cgroups.update(slot.procs);
+            slot.cgroups = cgroups.table();
+        }
+    }
+
+    std::unique_ptr<SamplerBackend> sampler;
+    int timerFd = -1, wakeFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+    // Sampler thread only, apart from the requests below
+    ThreadSampler threads;
+    HostSummary summary;
+    CgroupView cgroups;
+    NameFilter filter;
+    std::atomic<bool> readSummary{true};  // the panel starts out shown
+    std::atomic<bool> readCgroups{false};
+    std::mutex requestsMutex;  // guards the requests the UI leaves for the next tick
+    std::string pendingFilter;
+    bool filterChanged = false;
+    std::vector<int> pendingToggles;
+};
+
+// The TUI side of --aggregate. One epoll thread takes the binary delta
+// streams of any number of --agent connections and keeps each host's live
+// rows; every interval it ranks each host's top K by the current sort key
+// and k-way merges them into one table of K "comm@host" rows, so a tick
+// costs K log(hosts) after the per-host ranking no matter how many rows the
+// fleet has. Receive buffers are bounded: one grows only to fit the frame
+// in it, and an agent that announces a frame over kMaxFrameBytes or breaks
+// the protocol is dropped. Pids and start times repeat across hosts, so
+// published rows carry a per-host id in the top bits of their start time;
+// that keeps history, sparklines and screen tags apart for each host.
+class Aggregator : public SnapshotSource {
+public:
+    Aggregator(size_t topK, std::chrono::milliseconds interval) : topK(topK), interval(interval) {}
+    ~Aggregator() override {
+        if (thread.joinable()) {
+            uint64_t one = 1;
+            if (write(stopFd, &one, sizeof(one)) < 0) {}
+            thread.join();
+        }
+        for (auto &entry : agents) close(entry.first);
+        for (int fd : {listenFd, epollFd, stopFd, timerFd, wakeFd})
+            if (fd >= 0) close(fd);
+    }
+
+    // Listens for agents on "[host]:port"; an empty host means every interface.
+    bool start(const std::string &address, std::string &error) {
+        listenFd = listenTcp(address, error);
+        if (listenFd < 0) return false;
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epollFd < 0 || stopFd < 0 || timerFd < 0 || wakeFd < 0 || notifyFd < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        for (int fd : {listenFd, stopFd, timerFd, wakeFd}) watch(fd);
+        armTimer(timerFd, interval);
+        thread = std::thread(&Aggregator::run, this);
+        return true;
+    }
+
+    bool started() const override { return thread.joinable(); }
+    void setInterval(std::chrono::milliseconds newInterval) override { armTimer(timerFd, newInterval); }
+    void setSortKey(SortKey key) override { sortKey.store((int)key, std::memory_order_relaxed); }
+
+    void requestSample() override {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {}
+    }
+
+private:
+    static constexpr size_t kInitialBuffer = 64 << 10;
+    static constexpr size_t kMaxFrameBytes = 16 << 20;
+    static constexpr int kHostShift = 48;  // start times are jiffies, far below 2^48
+
+    struct Agent {
+        std::string host;  // empty until the hello arrives
+        uint64_t hostBits = 0;  // the host's id, shifted to kHostShift
+        std::vector<char> buffer = std::vector<char>(kInitialBuffer);
+        size_t used = 0;
+        std::unordered_map<ProcessKey, BinaryRecord, ProcessKeyHash> rows;
+        std::vector<const BinaryRecord *> ranked;  // top K of rows, best first
+        bool dirty = true;  // rows changed since ranked was built
+    };
+
+    void watch(int fd) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void run() {
+        profiler.attach("aggregator");
+        struct epoll_event events[64];
+        while (true) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0 && errno != EINTR) return;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                uint64_t count;
+                if (fd == stopFd) return;
+                if (fd == listenFd) acceptAgents();
+                else if (fd == timerFd || fd == wakeFd) {
+                    if (read(fd, &count, sizeof(count)) < 0) {}
+                    publish();
+                } else {
+                    readAgent(fd);
+                }
+            }
+        }
+    }
+
+    void acceptAgents() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            agents[fd];
+            watch(fd);
+        }
+    }
+
+    void dropAgent(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        agents.erase(fd);  // its rows leave the next merge
+    }
+
+    // Drains what the socket has, a bounded number of reads at a time so one
+    // busy agent can't starve the others; epoll comes back for the rest.
+    void readAgent(int fd) {
+        auto found = agents.find(fd);
+        if (found == agents.end()) return;
+        Agent &agent = found->second;
+        for (int reads = 0; reads < 16 && agent.used < agent.buffer.size(); ++reads) {
+            ssize_t n = recv(fd, agent.buffer.data() + agent.used, agent.buffer.size() - agent.used, 0);
+            countSyscalls(1, n);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if (n <= 0 || (agent.used += n, !consume(agent))) {
+                dropAgent(fd);
+                return;
+            }
+        }
+    }
+
+    // Applies every complete message at the front of the agent's buffer and
+    // keeps the partial one. Returns false if the stream is malformed.
+    bool consume(Agent &agent) {
+        size_t pos = 0, wanted = 0;
+        while (true) {
+            const char *p = agent.buffer.data() + pos;
+            size_t available = agent.used - pos;
+            if (agent.host.empty()) {
+                AgentHello hello;
+                if (available < sizeof(hello)) break;
+                memcpy(&hello, p, sizeof(hello));
+                if (memcmp(hello.magic, "MONH", 4) != 0 || hello.version != 1 || hello.hostLen == 0 ||
+                    hello.hostLen > kMaxHostLen)
+                    return false;
+                if (available < sizeof(hello) + hello.hostLen) break;
+                agent.host.assign(p + sizeof(hello), hello.hostLen);
+                // An agent that reconnects gets its old id back, so its history carries on
+                agent.hostBits = (uint64_t)hostIds.emplace(agent.host, hostIds.size() + 1).first->second << kHostShift;
+                pos += sizeof(hello) + hello.hostLen;
+                continue;
+            }
+
+            BinaryTickHeader header;
+            if (available < sizeof(header)) break;
+            memcpy(&header, p, sizeof(header));
+            if (memcmp(header.magic, "MONT", 4) != 0 || (header.version != 1 && header.version != 2) ||
+                header.recordSize != sizeof(BinaryRecord))
+                return false;
+            size_t frame = sizeof(header) + (size_t)header.recordCount * sizeof(BinaryRecord) +
+                           (size_t)header.exitCount * sizeof(BinaryExit);
+            if (frame > kMaxFrameBytes) return false;
+            if (available < frame) {
+                wanted = frame;
+                break;
+            }
+
+            const char *record = p + sizeof(header);
+            for (uint32_t i = 0; i < header.recordCount; ++i, record += sizeof(BinaryRecord)) {
+                BinaryRecord row;
+                memcpy(&row, record, sizeof(row));
+                row.name[sizeof(row.name) - 1] = 0;
+                agent.rows[ProcessKey{row.pid, row.startTime}] = row;
+            }
+            for (uint32_t i = 0; i < header.exitCount; ++i, record += sizeof(BinaryExit)) {
+                BinaryExit exit;
+                memcpy(&exit, record, sizeof(exit));
+                agent.rows.erase(ProcessKey{exit.pid, exit.startTime});
+            }
+            agent.dirty = true;
+            pos += frame;
+        }
+        memmove(agent.buffer.data(), agent.buffer.data() + pos, agent.used - pos);
+        agent.used -= pos;
+        if (wanted > agent.buffer.size()) agent.buffer.resize(wanted);
+        return true;
+    }
+
+    double rankValue(const BinaryRecord &row, SortKey key) const {
+        return key == SortKey::Ram ? (double)row.rssKb : (double)row.cpuCentiPercent;  // I/O isn't streamed
+    }
+
+    void publish() {
+        ProfileScope scope(Stage::Scan);  // the merge stands in for a scan
+        Snapshot &slot = buffer.writeSlot();
+        unsigned long long allocsBefore = heapAllocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        SortKey key = SortKey(sortKey.load(std::memory_order_relaxed));
+        auto better = [&](const BinaryRecord *a, const BinaryRecord *b) {
+            double va = rankValue(*a, key), vb = rankValue(*b, key);
+            return va != vb ? va > vb : a->pid < b->pid;
+        };
+
+        // Per host: its own top K, rebuilt only when a frame touched it
+        hosts.clear();
+        for (auto &entry : agents) {
+            Agent &agent = entry.second;
+            if (agent.host.empty()) continue;
+            if (agent.dirty || key != rankedKey) {
+                agent.ranked.clear();
+                for (const auto &row : agent.rows) agent.ranked.push_back(&row.second);
+                size_t keep = std::min(topK, agent.ranked.size());
+                std::partial_sort(agent.ranked.begin(), agent.ranked.begin() + keep, agent.ranked.end(), better);
+                agent.ranked.resize(keep);
+                agent.dirty = false;
+            }
+            if (!agent.ranked.empty()) hosts.push_back(&agent);
+        }
+        rankedKey = key;
+
+        // Then the global top K: a heap holding each host's best unmerged row
+        ProcessTable &procs = slot.procs;
+        procs.clear();
+        procs.names = &names;
+        heads.clear();
+        for (size_t h = 0; h < hosts.size(); ++h) heads.push_back({h, 0});
+        auto worse = [&](const Head &a, const Head &b) {
+            return better(hosts[b.host]->ranked[b.pos], hosts[a.host]->ranked[a.pos]);
+        };
+        std::make_heap(heads.begin(), heads.end(), worse);
+        while (!heads.empty() && procs.size() < topK) {
+            std::pop_heap(heads.begin(), heads.end(), worse);
+            Head &head = heads.back();
+            const Agent &agent = *hosts[head.host];
+            const BinaryRecord &row = *agent.ranked[head.pos];
+            label.assign(row.name, strnlen(row.name, sizeof(row.name)));
+            label += '@';
+            label += agent.host;
+            procs.push(row.pid, row.cpuCentiPercent / 100.0, row.rssKb, row.swapKb, row.startTime | agent.hostBits,
+                       names.intern(label.data(), label.size()));
+            if (++head.pos < agent.ranked.size()) std::push_heap(heads.begin(), heads.end(), worse);
+            else heads.pop_back();
+        }
+        procs.selectAll();
+        procs.tick = ++ticks;
+
+        slot.ok = true;
+        slot.agents = (unsigned)hosts.size();
+        slot.scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        slot.heapAllocations = heapAllocations.load(std::memory_order_relaxed) - allocsBefore;
+        announce();
+    }
+
+    struct Head {
+        size_t host, pos;
+    };
+
+    size_t topK;
+    std::chrono::milliseconds interval;
+    std::atomic<int> sortKey{(int)SortKey::Cpu};
+    int listenFd = -1, epollFd = -1, stopFd = -1, timerFd = -1, wakeFd = -1;
+    std::unordered_map<int, Agent> agents;  // by socket fd
+    std::unordered_map<std::string, uint32_t> hostIds;  // every host seen, from 1
+    NamePool names;
+    // Scratch reused by every publish
+    std::vector<Agent *> hosts;
+    std::vector<Head> heads;
+    std::string label;
+    SortKey rankedKey = SortKey::Cpu;
+    unsigned long long ticks = 0;
+    std::thread thread;
+};
+
+// Knobs for the TUI itself, as opposed to how a tick is sampled.
+struct InteractiveOptions {
+    std::string filter;
+    std::chrono::milliseconds interval{1000};
+    double cpuBudget = 0;         // % of one core the adaptive interval aims for; 0 keeps it fixed
+    unsigned historyTicks = 60;   // ticks kept for sparklines and rolling stats
+    std::string aggregate;        // listen here for --agent streams instead of sampling locally
+};
+
+// Formats a CLOCK_REALTIME timestamp as local "YYYY-MM-DD HH:MM:SS".
+std::string formatTimestamp(uint64_t timestampNs) {
+    time_t seconds = (time_t)(timestampNs / 1000000000);
+    struct tm local;
+    char text[32];
+    localtime_r(&seconds, &local);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    return text;
+}
+
+// Parses "HH:MM" or "HH:MM:SS" as a local time on the same day as
+// dayTimestampNs. Returns false if malformed.
+bool parseTimeOfDay(const std::string &text, uint64_t dayTimestampNs, uint64_t &out) {
+    int hour, minute, second = 0;
+    if (sscanf(text.c_str(), "%d:%d:%d", &hour, &minute, &second) < 2) return false;
+    time_t seconds = (time_t)(dayTimestampNs / 1000000000);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    local.tm_hour = hour;
+    local.tm_min = minute;
+    local.tm_sec = second;
+    local.tm_isdst = -1;
+    time_t target = mktime(&local);
+    if (target < 0) return false;
+    out = (uint64_t)target * 1000000000;
+    return true;
+}
+
+// Interactive TUI. Blocks in poll() on stdin, the sampler thread's ready
+// eventfd and a signalfd for SIGWINCH/SIGINT/SIGTERM/SIGHUP, so keys are
+// handled as soon as they arrive, even mid-scan. With a recording, ticks
+// come from it instead of /proc and the keys scrub through it.
+int runInteractive(const SampleOptions &options, const InteractiveOptions &ui, Recording *replay = nullptr) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGWINCH);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    // Blocked before the sampler's workers start so they inherit the mask
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    // Remote: the ticks are other hosts' processes, so the keys that act on
+    // this machine are off
+    bool remote = !ui.aggregate.empty();
+    std::unique_ptr<SnapshotSource> sampler;
+    if (remote) {
+        auto aggregator = std::make_unique<Aggregator>(options.topK ? options.topK : 100, ui.interval);
+        std::string error;
+        if (!aggregator->start(ui.aggregate, error)) {
+            std::cerr << "Failed to listen on " << ui.aggregate << ": " << error << "\n";
             return 1;
         }
+        sampler = std::move(aggregator);
+    } else if (!replay) {
+        sampler = std::make_unique<SamplerThread>(options, ui.interval);
+    }
+    if (signalFd < 0 || (sampler && !sampler->started())) {
+        std::perror("Failed to set up the event loop");
+        return 1;
+    }
+
+    ProcessTable replayProcs;
+    ProcessTable *current = &replayProcs;  // the table on screen: a replayed tick or the sampler's latest snapshot
+    NamePool replayNames;
+    replayProcs.names = &replayNames;
+    size_t replayTick = 0;
+    Screen screen;
+    RawTerminal terminal;
+    std::vector<RankedRow> ranked;
+    SortKey sortKey = SortKey::Cpu;
+    RefreshScheduler refresh(ui.interval, ui.cpuBudget);
+    NameFilter filter;
+    const Snapshot *live = nullptr;  // the sampler's latest, with its panels
+    bool haveCgroups = !findCgroup2Mount().empty();
+    bool groupByCgroup = false;
+    // Sorting by I/O also shows the disk rates
+    SampleOptions ioSortOptions = options;
+    ioSortOptions.columns |= columnBit(Column::DiskRead) | columnBit(Column::DiskWrite);
+    // Cgroup rows only carry the summed columns
+    SampleOptions cgroupOptions = options;
+    cgroupOptions.columns &= columnBit(Column::Cpu) | columnBit(Column::Rss) | columnBit(Column::Swap);
+    ProcessHistory history(ui.historyTicks);
+    bool showHistory = false;
+    bool showProfile = false;
+    std::optional<ProfileScope> renderScope;
+    bool showSummary = !replay && !remote;  // the live system only; recordings don't carry it
+    // Rows left unchanged by a tick can reuse their screen lines only if the
+    // frame on screen shows the tick before (or the same tick)
+    unsigned long long renderedTick = 0;
+    std::string statusLine;
+    unsigned long long sampleAllocs = 0;
+    unsigned agentCount = 0;
+    if (!filter.set(ui.filter, statusLine)) {
+        std::cerr << "Invalid filter: " << statusLine << "\n";
+        return 1;
+    }
+
+    if (sampler) sampler->setInterval(refresh.interval());
+    bool needSample = replay != nullptr, running = true, stdinOpen = true;
+    int exitCode = 0;
+    // Self-overhead shown in the footer: wall time of the last scan and
+    // render, plus the interval and CPU share measured between ticks.
+    using Clock = std::chrono::steady_clock;
+    double scanMs = 0, renderMs = 0, achievedMs = 0, selfCpuPercent = 0;
+    Clock::time_point lastTick = Clock::now();
+    double lastTickCpu = processCpuSeconds();
 
-        if (!filterString.empty()) {
-            procs.erase(std::remove_if(procs.begin(), procs.end(),
-                [&](const ProcessInfo &p) {
-                    return p.name.find(filterString) == std::string::npos;
-                }), procs.end());
+    while (running) {
+        if (needSample) {  // replay only; live ticks arrive from the sampler thread
+            auto scanStart = Clock::now();
+            if (!replay->load(replayTick, replayProcs, replayNames)) {
+                std::cerr << "Corrupt tick in the recording.\n";
+                exitCode = 1;
+                break;
+            }
+            filter.apply(replayProcs);
+            history.update(replayProcs);
+            scanMs = std::chrono::duration<double, std::milli>(Clock::now() - scanStart).count();
+            needSample = false;
         }
+        ProcessTable &procs = *current;
 
-        if (sortByCPU) {
-            std::sort(procs.begin(), procs.end(),
-                [](const ProcessInfo &a, const ProcessInfo &b) {
-                    return a.cpuUsage > b.cpuUsage;
-                });
+        auto renderStart = Clock::now();
+        renderScope.emplace(Stage::Render);
+        const int footerRows = 4;
+        screen.beginFrame();
+        int summaryRows = showSummary && live && live->hasSummary ? live->summary.render(screen) : 0;
+        int reservedRows = footerRows + summaryRows;
+        size_t visibleRows = std::max(0, screen.rows() - reservedRows - 1);
+        const ProcessTable &shown = groupByCgroup && live ? live->cgroups : procs;
+        rankTopK(shown, sortKey, visibleRows, ranked);
+
+        int drawn = showProfile ? printProfile(screen, visibleRows + 1)
+                  : groupByCgroup ? printProcessList(shown, ranked, cgroupOptions, screen, reservedRows, nullptr, nullptr, "PROCS",
+                                                     "CGROUP")
+                                  : printProcessList(procs, ranked, sortKey == SortKey::Io ? ioSortOptions : options, screen,
+                                                     reservedRows, live ? &live->threads : nullptr,
+                                                     showHistory ? &history : nullptr, "PID", "NAME",
+                                                     !replay && procs.tick - renderedTick <= 1);
+        for (int r = summaryRows + drawn; r < screen.rows() - footerRows; ++r) screen.addLine("", 0);
+        char footer[256];
+        int len = snprintf(footer, sizeof(footer), "%zu/%zu processes%s%s | ", procs.selectedCount, procs.size(),
+                           filter.text().empty() ? "" : " matching ", filter.text().c_str());
+        if (groupByCgroup) len += snprintf(footer + len, sizeof(footer) - len, "%zu cgroups | ", shown.size());
+        if (remote) len += snprintf(footer + len, sizeof(footer) - len, "%u agents on %s | ", agentCount, ui.aggregate.c_str());
+        if (replay) {
+            len += snprintf(footer + len, sizeof(footer) - len, "tick %zu/%zu recorded %s", replayTick + 1,
+                            replay->tickCount(), formatTimestamp(replay->timestampNs(replayTick)).c_str());
         } else {
-            std::sort(procs.begin(), procs.end(),
-                [](const ProcessInfo &a, const ProcessInfo &b) {
-                    return a.ramUsage > b.ramUsage;
-                });
-        }
-
-        printProcessList(procs);
-        std::cout << "\n[q] Quit | [k] Kill PID | [s] Sort Toggle | [f] Filter | [+/-] Refresh: " 
-                  << refreshInterval << "s\n";
-
-        char c = getNonBlockingInput();
-        if (c != 0) {
-            if (c == 'q') break;
-            else if (c == 's') sortByCPU = !sortByCPU;
-            else if (c == '+') refreshInterval = std::min(refreshInterval + 1, 10);
-            else if (c == '-') refreshInterval = std::max(refreshInterval - 1, 1);
-            else if (c == 'f') {
-                std::cout << "\nEnter filter substring: ";
-                std::cin >> filterString;
-            }
-            else if (c == 'k') {
-                int pid;
-                std::cout << "\nEnter PID to kill: ";
-                std::cin >> pid;
-                if (kill(pid, SIGTERM) == 0) {
-                    std::cout << "Process " << pid << " terminated.\n";
-                } else {
-                    std::perror("Failed to kill process");
+            len += snprintf(footer + len, sizeof(footer) - len, "sampled with %llu heap allocations", sampleAllocs);
+        }
+        screen.addLine(footer, len);
+        len = snprintf(footer, sizeof(footer), "scan %.1fms | render %.1fms | interval %.0fms | self CPU %.2f%%",
+                       scanMs, renderMs, achievedMs, selfCpuPercent);
+        if (refresh.budgetPercent() > 0)
+            len += snprintf(footer + len, sizeof(footer) - len, " of %.2f%% budget", refresh.budgetPercent());
+        screen.addLine(footer, len);
+        screen.addLine(statusLine);
+        if (replay) {
+            len = snprintf(footer, sizeof(footer),
+                           "[q] Quit | [s] Sort: %s | [f] Filter | [h] History | [?] Profile | [ [ ] ] Step | [ { } ] Step 60 | [g] Go to time",
+                           sortKeyName(sortKey));
+        } else if (remote) {
+            len = snprintf(footer, sizeof(footer), "[q] Quit | [s] Sort: %s | [f] Filter | [h] History | [?] Profile | [+/-] Refresh: %lldms",
+                           sortKeyName(sortKey), (long long)refresh.requested().count());
+        } else {
+            len = snprintf(footer, sizeof(footer),
+                           "[q] Quit | [k] Kill PID | [s] Sort: %s | [f] Filter | [h] History | [?] Profile | [i] Summary | [t] Threads | [c] Cgroups | [+/-] Refresh: %lldms",
+                           sortKeyName(sortKey), (long long)refresh.requested().count());
+            if (refresh.interval() != refresh.requested())
+                len += snprintf(footer + len, sizeof(footer) - len, " (stretched to %lldms)",
+                                (long long)refresh.interval().count());
+        }
+        screen.addLine(footer, len);
+        screen.present();
+        renderedTick = showProfile ? 0 : procs.tick;  // the overlay took the process rows' lines
+        renderScope.reset();
+        renderMs = std::chrono::duration<double, std::milli>(Clock::now() - renderStart).count();
+
+        struct pollfd fds[3] = {
+            {stdinOpen ? STDIN_FILENO : -1, POLLIN, 0},
+            {sampler ? sampler->readyFd() : -1, POLLIN, 0},
+            {signalFd, POLLIN, 0},
+        };
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            std::perror("poll");
+            exitCode = 1;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t published;
+            if (read(sampler->readyFd(), &published, sizeof(published)) > 0 && sampler->snapshots().acquire()) {
+                Snapshot &snapshot = sampler->snapshots().readSlot();
+                if (!snapshot.ok) {
+                    std::cerr << "Failed to read /proc.\n";
+                    exitCode = 1;
+                    break;
+                }
+                live = &snapshot;
+                current = &snapshot.procs;
+                filter.apply(snapshot.procs);
+                history.update(snapshot.procs);
+                sampleAllocs = snapshot.heapAllocations;
+                scanMs = snapshot.scanMs;
+                agentCount = snapshot.agents;
+
+                Clock::time_point now = Clock::now();
+                double cpu = processCpuSeconds();
+                double wallSeconds = std::chrono::duration<double>(now - lastTick).count();
+                achievedMs = wallSeconds * 1000;
+                selfCpuPercent = wallSeconds > 0 ? (cpu - lastTickCpu) / wallSeconds * 100 : 0;
+                if (refresh.update((cpu - lastTickCpu) / published)) sampler->setInterval(refresh.interval());
+                lastTick = now;
+                lastTickCpu = cpu;
+            }
+        }
+
+        if (fds[2].revents & POLLIN) {
+            // SIGWINCH needs no handling: the redraw at the top of the loop picks up the new size
+            struct signalfd_siginfo info;
+            if (read(signalFd, &info, sizeof(info)) == sizeof(info) && info.ssi_signo != SIGWINCH) running = false;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            char keys[64];
+            ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+            if (n <= 0) stdinOpen = false;  // EOF: keep sampling without input
+            for (ssize_t i = 0; i < n && running; ++i) {
+                char c = keys[i];
+                if (c == 'q') running = false;
+                else if (c == 's') {
+                    sortKey = SortKey(((int)sortKey + 1) % (int)SortKey::Count);
+                    screen.invalidate();  // I/O order adds columns, so reused lines would have the old layout
+                    // io is only read while a column or the sort order needs it
+                    if (sampler) {
+                        sampler->setExtraReads(sortKey == SortKey::Io ? (unsigned)ReadsIo : 0u);
+                        sampler->setSortKey(sortKey);
+                    }
+                }
+                else if (c == 'h') showHistory = !showHistory;
+                else if (c == '?') showProfile = !showProfile;
+                else if (c == 'f') {
+                    std::string error;
+                    std::string pattern = promptLine(terminal, "Enter filter (text, ^prefix or ~regex): ");
+                    if (filter.set(pattern, error)) {
+                        filter.apply(procs);
+                        if (sampler) sampler->setFilter(pattern);
+                        if (groupByCgroup) sampler->requestSample();  // rollups cover only the selected rows
+                    } else {
+                        statusLine = "Invalid filter: " + error;
+                    }
+                    screen.invalidate();
+                }
+                else if (replay && (c == '[' || c == ']' || c == '{' || c == '}')) {
+                    long step = c == '[' ? -1 : c == ']' ? 1 : c == '{' ? -60 : 60;
+                    replayTick = (size_t)std::max(0L, std::min((long)replay->tickCount() - 1, (long)replayTick + step));
+                    needSample = true;
+                }
+                else if (replay && c == 'g') {
+                    uint64_t target;
+                    std::string text = promptLine(terminal, "Go to time (HH:MM[:SS]): ");
+                    if (parseTimeOfDay(text, replay->timestampNs(replayTick), target)) {
+                        replayTick = replay->findTick(target);
+                        needSample = true;
+                    } else {
+                        statusLine = "Invalid time: " + text;
+                    }
+                    screen.invalidate();
+                }
+                else if (replay) continue;  // the remaining keys act on the live system
+                else if (c == '+' || c == '-') {
+                    refresh.adjust(c == '+');
+                    sampler->setInterval(refresh.interval());
+                }
+                else if (remote) continue;  // the rest act on this host
+                else if (c == 'i') {
+                    showSummary = !showSummary;
+                    sampler->setSummary(showSummary);
+                    if (showSummary) sampler->requestSample();
+                }
+                else if (c == 'c') {
+                    if (!haveCgroups) {
+                        statusLine = "No cgroup v2 hierarchy is mounted.";
+                        continue;
+                    }
+                    groupByCgroup = !groupByCgroup;
+                    screen.invalidate();
+                    statusLine = groupByCgroup ? "Grouping by cgroup." : "";
+                    sampler->setGroupByCgroup(groupByCgroup);
+                    if (groupByCgroup) sampler->requestSample();
+                }
+                else if (c == 't') {
+                    int pid = atoi(promptLine(terminal, "Enter PID to expand/collapse threads: ").c_str());
+                    if (pid <= 0) {
+                        statusLine = "Invalid PID.";
+                    } else {
+                        bool expanded = live && live->threads.threadsOf(pid);
+                        statusLine = (expanded ? "Hiding threads of " : "Showing threads of ") + std::to_string(pid);
+                        sampler->toggleThreads(pid);
+                        sampler->requestSample();
+                    }
+                    screen.invalidate();
+                }
+                else if (c == 'k') {
+                    int pid = atoi(promptLine(terminal, "Enter PID to kill: ").c_str());
+                    if (pid <= 0) statusLine = "Invalid PID.";
+                    else if (kill(pid, SIGTERM) == 0) statusLine = "Process " + std::to_string(pid) + " terminated.";
+                    else statusLine = "Failed to kill process " + std::to_string(pid) + ": " + strerror(errno);
+                    screen.invalidate();
+                    sampler->requestSample();
+                }
+            }
+        }
+    }
+
+    close(signalFd);
+    return exitCode;
+}
+
+int main(int argc, char **argv) {
+    SampleOptions options;
+    ExportOptions exportOptions;
+    bool bench = false;
+    std::vector<unsigned> benchCounts = {1000, 10000, 100000};
+    InteractiveOptions interactive;
+    std::string recordPath, replayPath, serveAddress, agentAddress, tracePath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool valid = true;
+        if (arg == "--status") options.columns |= columnBit(Column::Swap);
+        else if (arg.rfind("--columns=", 0) == 0) valid = parseColumns(arg.substr(10), options.columns);
+        else if (arg.rfind("--threads=", 0) == 0) options.threads = std::max(1, atoi(arg.c_str() + 10));
+        else if (arg == "--bench") bench = true;
+        else if (arg.rfind("--bench-procs=", 0) == 0) {
+            // comma-separated synthetic /proc sizes; empty benches the live /proc only
+            benchCounts.clear();
+            for (const char *p = arg.c_str() + 14; *p;) {
+                char *end;
+                long count = strtol(p, &end, 10);
+                if (end == p || count <= 0) {
+                    valid = false;
+                    break;
                 }
-                std::this_thread::sleep_for(std::chrono::seconds(2));
+                benchCounts.push_back((unsigned)count);
+                p = *end == ',' ? end + 1 : end;
             }
         }
+        else if (arg.rfind("--backend=", 0) == 0) {
+            options.backend = arg.substr(10);
+            valid = options.backend == "proc" || options.backend == "netlink" || options.backend == "io_uring" ||
+                    options.backend == "bpf";
+        }
+        else if (arg.rfind("--top=", 0) == 0) {
+            options.topK = (size_t)atol(arg.c_str() + 6);
+            valid = options.topK > 0;
+        }
+        else if (arg.rfind("--export=", 0) == 0) {
+            std::string format = arg.substr(9);
+            if (format == "jsonl") exportOptions.format = ExportFormat::Jsonl;
+            else if (format == "csv") exportOptions.format = ExportFormat::Csv;
+            else if (format == "binary") exportOptions.format = ExportFormat::Binary;
+            else valid = false;
+        }
+        else if (arg.rfind("--interval=", 0) == 0) {
+            exportOptions.interval = parseInterval(arg.substr(11));
+            valid = exportOptions.interval.count() > 0;
+        }
+        else if (arg.rfind("--cpu-budget=", 0) == 0) {
+            interactive.cpuBudget = strtod(arg.c_str() + 13, nullptr);
+            valid = interactive.cpuBudget > 0 && interactive.cpuBudget <= 100;
+        }
+        else if (arg.rfind("--history=", 0) == 0) {
+            interactive.historyTicks = (unsigned)atoi(arg.c_str() + 10);
+            valid = interactive.historyTicks >= 2 && interactive.historyTicks <= 4096;
+        }
+        else if (arg.rfind("--record=", 0) == 0) recordPath = arg.substr(9);
+        else if (arg.rfind("--replay=", 0) == 0) replayPath = arg.substr(9);
+        else if (arg.rfind("--serve=", 0) == 0) serveAddress = arg.substr(8);
+        else if (arg.rfind("--agent=", 0) == 0) agentAddress = arg.substr(8);
+        else if (arg.rfind("--aggregate=", 0) == 0) interactive.aggregate = arg.substr(12);
+        else if (arg == "--delta") exportOptions.delta = true;
+        else if (arg.rfind("--output=", 0) == 0) exportOptions.outputPath = arg.substr(9);
+        else if (arg.rfind("--filter=", 0) == 0) exportOptions.filter = arg.substr(9);
+        else if (arg.rfind("--ticks=", 0) == 0) exportOptions.ticks = std::max(0L, atol(arg.c_str() + 8));
+        else if (arg.rfind("--trace=", 0) == 0) tracePath = arg.substr(8);
+        else valid = false;
 
-        std::this_thread::sleep_for(std::chrono::seconds(refreshInterval));
+        if (!valid) {
+            std::cerr << "Usage: " << argv[0] << " [--status] [--threads=N] [--backend=proc|netlink|io_uring|bpf]\n"
+                      << "       [--top=N] [--columns=cpu,rss,swap,vsz,threads,state,read,write,rchar,wchar]\n"
+                      << "       [--bench] [--bench-procs=1000,10000,100000]\n"
+                      << "       [--export=jsonl|csv|binary] [--delta] [--interval=250ms|2s] [--output=FILE]\n"
+                      << "       [--filter=SUBSTRING] [--ticks=N] [--cpu-budget=PERCENT] [--history=TICKS]\n"
+                      << "       [--record=FILE] [--replay=FILE] [--serve=[HOST]:PORT]\n"
+                      << "       [--agent=HOST:PORT] [--aggregate=[HOST]:PORT] [--trace=FILE]\n";
+            return 1;
+        }
     }
+    options.readStatus = columnReads(options.columns) & ReadsStatus;
+    interactive.filter = exportOptions.filter;
+    options.filter = exportOptions.filter;
+    interactive.interval = exportOptions.interval;
+    // The trace ring is sized per thread as it attaches, so this comes first
+    profiler.tracing.store(!tracePath.empty(), std::memory_order_relaxed);
+    profiler.attach("main");
+    auto run = [&]() -> int {
+        if (bench) return runBench(options, benchCounts, exportOptions.filter);
+        if (exportOptions.format != ExportFormat::None) return runExport(options, exportOptions);
+        if (!recordPath.empty()) return runRecord(options, exportOptions, recordPath);
+        if (!serveAddress.empty()) return runServe(options, exportOptions, serveAddress);
+        if (!agentAddress.empty()) return runAgent(options, exportOptions, agentAddress);
+        if (!replayPath.empty()) {
+            Recording recording;
+            if (!recording.open(replayPath.c_str())) {
+                std::cerr << "Failed to open recording " << replayPath << "\n";
+                return 1;
+            }
+            options.readStatus = recording.hasSwap(0);
+            if (options.readStatus) options.columns |= columnBit(Column::Swap);
+            else options.columns &= ~columnBit(Column::Swap);
+            return runInteractive(options, interactive, &recording);
+        }
 
-    return 0;
+        return runInteractive(options, interactive);
+    };
+    int exitCode = run();
+    if (!tracePath.empty() && !writeTrace(tracePath)) {
+        std::perror(tracePath.c_str());
+        return 1;
+    }
+    return exitCode;
 }